@@ -0,0 +1,128 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+#include <ctype.h>
+
+/*
+ * Aho-Corasick automaton, shared by the message filter and the obituary
+ * parser
+ */
+
+/*
+==============
+automaton_free
+Releases the tables of an automaton. Freeing one that was never built, or
+twice, is fine.
+==============
+ */
+void automaton_free(automaton_t *a) {
+    qw_free(a->next);
+    memset(a, 0, sizeof (*a));
+}
+
+/*
+==============
+automaton_build
+Builds an automaton of the patterns. States are trie nodes of the
+patterns, and each state's transitions are completed with those of its
+failure state, so that matching never backtracks. Empty patterns never
+match. Returns false if the tables couldn't be allocated.
+==============
+ */
+bool automaton_build(automaton_t *a, char **patterns, int count, bool fold_case, memtag_t tag) {
+    uint16_t *fail, *queue, *row;
+    int max_states = 1, head = 0, tail = 0, s, t, c, i;
+    byte *p;
+
+    memset(a, 0, sizeof (*a));
+
+    // Only characters that occur in patterns need a column of their own
+    a->width = 1;
+    for (i = 0; i < count; i++) {
+        for (p = (byte *) patterns[i]; *p; p++, max_states++) {
+            c = fold_case ? tolower(*p) : *p;
+            if (a->map[c])
+                continue;
+            a->map[c] = a->width++;
+            if (fold_case)
+                a->map[toupper(c)] = a->map[c];
+        }
+    }
+    if (max_states > 65535) {
+        printf("Error: Too many patterns. (automaton_build())\n");
+        memset(a, 0, sizeof (*a));
+        return false;
+    }
+
+    // The three tables are one block
+    a->next = qw_malloc(tag, max_states * (a->width * sizeof (uint16_t) + sizeof (int16_t) + sizeof (uint16_t)));
+    fail = qw_malloc(tag, max_states * sizeof (uint16_t) * 2);
+    if (!a->next || !fail) {
+        printf("Error: Out of memory. (automaton_build())\n");
+        qw_free(fail);
+        automaton_free(a);
+        return false;
+    }
+    a->pattern = (int16_t *) (a->next + max_states * a->width);
+    a->output = (uint16_t *) (a->pattern + max_states);
+    queue = fail + max_states;
+    memset(a->next, 0, max_states * a->width * sizeof (uint16_t));
+    memset(a->pattern, 0xff, max_states * sizeof (int16_t));
+    memset(a->output, 0, max_states * sizeof (uint16_t));
+
+    // The trie, state 0 is the root and never a child
+    a->states = 1;
+    for (i = 0; i < count; i++) {
+        if (!patterns[i][0])
+            continue;
+        for (s = 0, p = (byte *) patterns[i]; *p; p++) {
+            row = a->next + s * a->width;
+            if (!row[a->map[*p]])
+                row[a->map[*p]] = a->states++;
+            s = row[a->map[*p]];
+        }
+        // Of patterns that are the same, the state reports the first one
+        if (a->pattern[s] < 0)
+            a->pattern[s] = i;
+    }
+
+    // Breadth first, so a state's failure state is always done before it
+    for (c = 1; c < a->width; c++) {
+        if ((t = a->next[c])) {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while (head < tail) {
+        s = queue[head++];
+        row = a->next + s * a->width;
+        for (c = 1; c < a->width; c++) {
+            if ((t = row[c])) {
+                fail[t] = a->next[fail[s] * a->width + c];
+                a->output[t] = a->pattern[fail[t]] >= 0 ? fail[t] : a->output[fail[t]];
+                queue[tail++] = t;
+            } else
+                row[c] = a->next[fail[s] * a->width + c];
+        }
+    }
+    qw_free(fail);
+    return true;
+}
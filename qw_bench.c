@@ -0,0 +1,292 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "qw_common.h"
+
+/*
+ * Microbenchmarks for the protocol hot paths, run with "make bench".
+ * Payloads are modelled after what a KTX server sends during a match.
+ */
+
+extern long standalone_allocs;
+
+typedef struct {
+    char *name;
+    int (*setup)(void);                 // Called once before timing, returns payload bytes per operation
+    void (*run)(void);                  // One operation
+} bench_t;
+
+static byte payload[MAX_MSG_LEN];
+static int payload_len;
+static char text[MAX_STRING_CHARS];
+
+static char *ktx_chat = "\x8d\xd5\xf3\xe5\xf2\x8d: gg, one more? \x1c\x10" "dm2\x11\n";
+static char *ktx_serverinfo = "\\maxfps\\77\\pm_ktjump\\1\\*version\\MVDSV 0.32\\*z_ext\\511"
+    "\\maxclients\\8\\timelimit\\20\\teamplay\\2\\deathmatch\\1\\fraglimit\\0"
+    "\\map\\dm2\\status\\Standby\\ktxver\\1.38\\*gamedir\\qw\\hostname\\KTX Server";
+static char *ktx_stufftext = "fullserverinfo \"\\maxfps\\77\\*version\\MVDSV 0.32"
+    "\\map\\dm2\\status\\Standby\\ktxver\\1.38\"\n";
+static char *ktx_centerprint = "\n   Welcome to KTX\n\n Type \"commands\" for help \n\n   Have fun!\n";
+static char *ktx_fragfile = "#FRAGFILE VERSION ezquake-1.00\n"
+    "#DEFINE WEAPON_CLASS 1 AXE axe\n"
+    "#DEFINE WEAPON_CLASS 7 ROCKET_LAUNCHER rl\n"
+    "#DEFINE WEAPON_CLASS 8 LIGHTNING_GUN lg\n"
+    "#DEFINE OBITUARY PLAYER_SUICIDE 7 \" becomes bored with life\"\n"
+    "#DEFINE OBITUARY X_FRAGGED_BY_Y 1 \" was ax-murdered by \"\n"
+    "#DEFINE OBITUARY X_FRAGS_Y 7 \" rides \" \"'s rocket\"\n"
+    "#DEFINE OBITUARY X_FRAGGED_BY_Y 7 \" was gibbed by \" \"'s rocket\"\n"
+    "#DEFINE OBITUARY X_FRAGGED_BY_Y 8 \" accepts \" \"'s shaft\"\n";
+
+/*
+==============
+bench_time
+Returns monotonic time in nanoseconds
+==============
+ */
+static double bench_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+==============
+bench_payload
+Copies the payload into net_message and starts reading it
+==============
+ */
+static void bench_payload(void) {
+    memcpy(net_message.data, payload, payload_len);
+    net_message.cur_size = payload_len;
+    net_begin_read();
+}
+
+/*
+ * Benchmarked operations
+ */
+
+static int setup_read_string(void) {
+    netbuf_t buf;
+
+    buf_init(&buf, payload, sizeof (payload));
+    net_write_string(&buf, ktx_chat);
+    payload_len = buf.cur_size;
+    bench_payload();
+    return payload_len;
+}
+
+static void run_read_string(void) {
+    net_read_count = 0;
+    net_read_string(false);
+}
+
+static int setup_parse_frame(void) {
+    netbuf_t buf;
+
+    // A typical mid-match datagram: time, a frag message, chat and scores
+    qw.print_filter = 0;
+    buf_init(&buf, payload, sizeof (payload));
+    net_write_integer(&buf, svc_time, 1);
+    net_write_integer(&buf, 0x42c80000, 4);
+    net_write_integer(&buf, svc_print, 1);
+    net_write_integer(&buf, 1, 1);
+    net_write_string(&buf, "Bob rides Alice's rocket\n");
+    net_write_integer(&buf, svc_print, 1);
+    net_write_integer(&buf, 3, 1);
+    net_write_string(&buf, ktx_chat);
+    net_write_integer(&buf, svc_updatefrags, 1);
+    net_write_integer(&buf, 2, 1);
+    net_write_integer(&buf, 13, 2);
+    net_write_integer(&buf, svc_updateping, 1);
+    net_write_integer(&buf, 2, 1);
+    net_write_integer(&buf, 25, 2);
+    net_write_integer(&buf, svc_updatestat, 1);
+    net_write_integer(&buf, 1, 1);
+    net_write_integer(&buf, 100, 1);
+    payload_len = buf.cur_size;
+    return payload_len;
+}
+
+static int setup_parse_filtered(void) {
+    // Same datagram with obituaries filtered out
+    setup_parse_frame();
+    qw.print_filter = 1 << PRINT_MEDIUM;
+    return payload_len;
+}
+
+static void run_parse_frame(void) {
+    bench_payload();
+    net_parse_command();
+}
+
+static int setup_cleantext(void) {
+    strcpy((char *) payload, ktx_chat);
+    payload_len = strlen(ktx_chat);
+    return payload_len;
+}
+
+static void run_cleantext(void) {
+    memcpy(text, payload, payload_len + 1);
+    qw_cleantext(text);
+}
+
+static int setup_filter(void) {
+    strcpy(text, ktx_chat);
+    qw_cleantext(text);
+    return strlen(text);
+}
+
+static void run_filter(void) {
+    relayclass_t class = relay_chat;
+
+    filter_line(text, &class);
+}
+
+static int setup_frags(void) {
+    char path[] = "/tmp/qwbenchXXXXXX";
+    int fd;
+
+    // The fragfile only needs to exist while it's loaded
+    if ((fd = mkstemp(path)) < 0)
+        return 0;
+    write(fd, ktx_fragfile, strlen(ktx_fragfile));
+    close(fd);
+    frags_load(path);
+    unlink(path);
+
+    strcpy(text, "Bob rides Alice's rocket\n");
+    return strlen(text);
+}
+
+static void run_frags(void) {
+    frags_line(text);
+}
+
+static int setup_centerprint(void) {
+    // The same centerprint over and over, relayed once
+    dedupe.ttl = 600000;
+    return strlen(ktx_centerprint);
+}
+
+static void run_centerprint(void) {
+    strcpy(text, ktx_centerprint);
+    exec_centerprint(text);
+}
+
+static int setup_tokenize(void) {
+    return strlen(ktx_stufftext);
+}
+
+static void run_tokenize(void) {
+    strcpy(text, ktx_stufftext);
+    parser_tokenize(text, true);
+}
+
+static int setup_infostring(void) {
+    return strlen(ktx_serverinfo);
+}
+
+static void run_infostring(void) {
+    infostring_from_string(serverinfo_root, ktx_serverinfo);
+    infostring_clear(serverinfo_root, false);
+}
+
+static int setup_rcon(void) {
+    strcpy(qw_rcon_password, "secret");
+    qw_encrypt_rcon = 1;
+    return strlen("kick Bob");
+}
+
+static void run_rcon(void) {
+    exec_rcon("kick Bob");
+}
+
+static bench_t benchmarks[] = {
+    {"net_read_string",        setup_read_string, run_read_string},
+    {"net_parse_command",      setup_parse_frame, run_parse_frame},
+    {"net_parse_command filter", setup_parse_filtered, run_parse_frame},
+    {"qw_cleantext",           setup_cleantext,   run_cleantext},
+    {"filter_line",            setup_filter,      run_filter},
+    {"frags_line",             setup_frags,       run_frags},
+    {"exec_centerprint",       setup_centerprint, run_centerprint},
+    {"parser_tokenize",        setup_tokenize,    run_tokenize},
+    {"infostring_from_string", setup_infostring,  run_infostring},
+    {"exec_rcon",              setup_rcon,        run_rcon},
+    {NULL,                     NULL,              NULL}
+};
+
+/*
+==============
+bench_run
+Runs a benchmark for about half a second and prints the results. Returns
+false if the operation still allocated memory after warming up.
+==============
+ */
+static bool bench_run(bench_t *b) {
+    long i, iters, allocs;
+    double start, elapsed;
+    int bytes;
+
+    payload_len = 0;
+    bytes = b->setup();
+
+    // Find an iteration count that takes long enough to time reliably
+    for (iters = 1000;; iters *= 2) {
+        start = bench_time();
+        for (i = 0; i < iters; i++)
+            b->run();
+        if ((elapsed = bench_time() - start) > 1e8)
+            break;
+    }
+
+    iters = iters * 5e8 / elapsed;
+    allocs = standalone_allocs;
+    start = bench_time();
+    for (i = 0; i < iters; i++)
+        b->run();
+    elapsed = bench_time() - start;
+    allocs = standalone_allocs - allocs;
+
+    printf("%-24s %10.1f ns/op %10.1f MB/s %8.2f allocs/op\n", b->name, elapsed / iters,
+            bytes * iters / elapsed * 1e3, (double) allocs / iters);
+    return !allocs;
+}
+
+int main(int argc, char **argv) {
+    bench_t *b;
+    int failed = 0;
+
+    net_message.data = net_message_buffer;
+    net_message.max_size = sizeof (net_message_buffer);
+    qw_cleantext_init();
+    infostring_init();
+    metrics_thread_start();
+    filter_defaults();
+    filter_update();
+
+    for (b = benchmarks; b->name; b++)
+        if (argc < 2 || strstr(b->name, argv[1]))
+            if (!bench_run(b)) {
+                printf("Error: %s allocates memory in steady state\n", b->name);
+                failed++;
+            }
+
+    return failed ? 1 : 0;
+}
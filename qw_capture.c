@@ -0,0 +1,416 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "qw_common.h"
+
+/*
+ * Packet capture and replay.
+ *
+ * A capture file starts with CAPTURE_MAGIC, followed by one record per
+ * received datagram: a capture_rec_t header in host byte order and the
+ * datagram itself.
+ */
+
+bool capture_replaying;                 // Is a capture being replayed?
+
+static FILE *capture_file;              // Capture being recorded
+static FILE *replay_out;                // Where replayed IRC output goes
+
+static flight_rec_t flight_ring[FLIGHT_RECORDS];
+static uint32_t flight_count;           // Datagrams recorded so far
+static __thread bool flight_thread;     // Set in the thread that records
+
+/*
+==============
+capture_time
+Returns monotonic time in nanoseconds
+==============
+ */
+static uint64_t capture_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+==============
+capture_open
+Starts recording received datagrams to a file. Returns false on error.
+==============
+ */
+bool capture_open(char *path) {
+    capture_close();
+
+    if (!(capture_file = fopen(path, "wb"))) {
+        printf("Error: Can't open capture file %s: %s. (capture_open())\n", path, strerror(errno));
+        return false;
+    }
+    fwrite(CAPTURE_MAGIC, 1, sizeof (CAPTURE_MAGIC), capture_file);
+
+    return true;
+}
+
+/*
+==============
+capture_close
+Stops recording
+==============
+ */
+void capture_close(void) {
+    if (capture_file) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+}
+
+/*
+==============
+capture_write
+Appends the datagram in net_message to the capture file, if recording
+==============
+ */
+void capture_write(void) {
+    capture_rec_t rec;
+
+    if (!capture_file)
+        return;
+
+    rec.time = capture_time();
+    rec.ip = net_from.ip.as_int;
+    rec.port = net_from.port;
+    rec.length = net_message.cur_size;
+
+    if (fwrite(&rec, sizeof (rec), 1, capture_file) != 1
+            || fwrite(net_message.data, 1, rec.length, capture_file) != rec.length) {
+        printf("Error: Writing capture failed: %s. Recording stopped. (capture_write())\n", strerror(errno));
+        capture_close();
+    }
+}
+
+/*
+==============
+capture_replay_output
+Writes a line that would have been sent to IRC during a replay
+==============
+ */
+void capture_replay_output(char *line) {
+    if (replay_out)
+        fputs(line, replay_out);
+}
+
+/*
+==============
+capture_replay
+Feeds a capture through the packet pipeline as fast as possible, with the
+clock following the capture timestamps. Nothing is transmitted and IRC
+output goes to out. Must not be used while the QuakeWorld thread runs.
+Returns the number of datagrams replayed, or -1 on error.
+==============
+ */
+int capture_replay(char *path, FILE *out, float *elapsed) {
+    FILE *in;
+    char magic[sizeof (CAPTURE_MAGIC)];
+    capture_rec_t rec;
+    uint64_t first = 0, start;
+    int count = 0, pri;
+
+    if (!(in = fopen(path, "rb"))) {
+        printf("Error: Can't open capture file %s: %s. (capture_replay())\n", path, strerror(errno));
+        return -1;
+    }
+    if (fread(magic, 1, sizeof (magic), in) != sizeof (magic)
+            || memcmp(magic, CAPTURE_MAGIC, sizeof (magic))) {
+        printf("Error: %s is not a capture file. (capture_replay())\n", path);
+        fclose(in);
+        return -1;
+    }
+
+    // Start from a clean session, the way the QuakeWorld thread does
+    memset(&netchan, 0, sizeof (netchan));
+    con_state = disconnected;
+    net_message.data = net_message_buffer;
+    net_message.max_size = MAX_UDP_PACKET;
+    qw_session_clear();
+
+    qw_mutex_lock();
+    filter_update();
+    filter_reset();
+    pthread_mutex_unlock(&qw_mutex);
+
+    capture_replaying = true;
+    replay_out = out;
+    start = capture_time();
+
+    while (fread(&rec, sizeof (rec), 1, in) == 1) {
+        if (rec.length > MAX_UDP_PACKET || fread(net_message.data, 1, rec.length, in) != rec.length) {
+            printf("Error: Truncated capture file %s. (capture_replay())\n", path);
+            break;
+        }
+
+        if (!first)
+            first = rec.time;
+        qw.realtime = (rec.time - first) / 1000000;
+
+        net_message.cur_size = rec.length;
+        net_from.ip.as_int = rec.ip;
+        net_from.port = rec.port;
+        count++;
+
+        // Same steps as in qw_frame()
+        if (*(int *) net_message.data == -1) {
+            net_oob_process();
+            continue;
+        }
+        if (net_message.cur_size < 8)
+            continue;
+
+        // The capture may begin in the middle of a session
+        if (con_state == disconnected) {
+            netchan_setup(&netchan, net_from, qw.qport);
+            con_set_state(active);
+        }
+
+        if (!netchan_process(&netchan))
+            continue;
+        net_parse_command();
+        summary_frame();
+        flood_frame();
+
+        // Commands for the server are never sent, don't let them pile up
+        buf_clear(&netchan.message);
+        buf_clear(&netchan.datagram);
+        for (pri = 0; pri < pri_count; pri++)
+            buf_clear(&netchan.cmd_queue[pri]);
+        netchan.say_count = netchan.say_packed = 0;
+    }
+
+    summary_flush();
+    flood_flush();
+    *elapsed = (capture_time() - start) / 1000000.0f;
+
+    capture_replaying = false;
+    replay_out = NULL;
+    infostring_clear(userinfo_root, true);
+    infostring_clear(serverinfo_root, true);
+    con_state = disconnected;
+    fclose(in);
+
+    return count;
+}
+
+/*
+ * Flight recorder
+ */
+
+/*
+==============
+flight_thread_start
+Makes the calling thread the flight recorder's only writer. Datagrams
+sent from other threads, like rcon from the partyline, aren't recorded.
+==============
+ */
+void flight_thread_start(void) {
+    flight_thread = true;
+}
+
+/*
+==============
+flight_open
+Marks a slot as being written, so readers copying it out meanwhile
+throw the copy away
+==============
+ */
+static void flight_open(flight_rec_t *rec) {
+    __atomic_store_n(&rec->serial, FLIGHT_WRITING, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+==============
+flight_close
+Publishes a slot once it has been written
+==============
+ */
+static void flight_close(flight_rec_t *rec, uint32_t serial) {
+    __atomic_store_n(&rec->serial, serial, __ATOMIC_RELEASE);
+}
+
+/*
+==============
+flight_record
+Copies a datagram into the flight recorder
+==============
+ */
+void flight_record(bool out, void *data, int length) {
+    flight_rec_t *rec = &flight_ring[flight_count % FLIGHT_RECORDS];
+
+    if (!flight_thread)
+        return;
+
+    flight_open(rec);
+    rec->time = capture_time();
+    rec->out = out;
+    rec->note = NULL;
+    rec->length = length;
+    memcpy(rec->data, data, MIN(length, FLIGHT_DATA));
+    flight_close(rec, flight_count);
+
+    // Publish the record only after it has been written
+    __atomic_store_n(&flight_count, flight_count + 1, __ATOMIC_RELEASE);
+}
+
+/*
+==============
+flight_note
+Marks the latest received datagram as the cause of a problem, along with
+how far it had been read
+==============
+ */
+void flight_note(char *note) {
+    flight_rec_t *rec;
+    uint32_t i;
+
+    if (!flight_thread)
+        return;
+
+    for (i = 1; i <= MIN(flight_count, FLIGHT_RECORDS); i++) {
+        rec = &flight_ring[(flight_count - i) % FLIGHT_RECORDS];
+        if (!rec->out) {
+            flight_open(rec);
+            rec->note_offset = net_read_count;
+            rec->note = note;
+            flight_close(rec, flight_count - i);
+            return;
+        }
+    }
+}
+
+/*
+==============
+flight_get
+Copies out the record back datagrams before the latest one. Returns false
+if there is no such record, or it was written to while being copied.
+==============
+ */
+bool flight_get(int back, flight_rec_t *rec) {
+    flight_rec_t *slot;
+    uint32_t count, serial;
+
+    // The oldest slot may be getting overwritten already
+    count = __atomic_load_n(&flight_count, __ATOMIC_ACQUIRE);
+    if (back < 0 || back >= (int) MIN(count, FLIGHT_RECORDS - 1))
+        return false;
+
+    serial = count - 1 - back;
+    slot = &flight_ring[serial % FLIGHT_RECORDS];
+    if (__atomic_load_n(&slot->serial, __ATOMIC_ACQUIRE) != serial)
+        return false;
+    memcpy(rec, slot, sizeof (*rec));
+
+    // Check that the slot wasn't written to while copying
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->serial, __ATOMIC_RELAXED) == serial
+        && rec->serial == serial;
+}
+
+/*
+==============
+flight_char
+Returns a byte of a datagram as a printable character
+==============
+ */
+static char flight_char(byte b) {
+    char c = qw_char_tbl[b];
+
+    // Control characters would be hard to tell from the text around them
+    return (b & 127) >= ' ' && c >= ' ' && c < 127 ? c : '.';
+}
+
+/*
+==============
+flight_long
+Reads a little-endian 32-bit integer
+==============
+ */
+static unsigned flight_long(byte *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned) p[3] << 24;
+}
+
+/*
+==============
+flight_describe
+Decodes the headers of a recorded datagram into a line of text. now is the
+time the listing started, times are shown relative to it.
+==============
+ */
+void flight_describe(flight_rec_t *rec, uint64_t now, char *line, int size) {
+    char text[41];
+    unsigned seq, ack;
+    int len, i, n;
+
+    n = snprintf(line, size, "#%u %+.3fs %s %d bytes", rec->serial,
+            ((int64_t) (rec->time - now)) / 1e9, rec->out ? "out" : "in ", rec->length);
+    len = MIN(rec->length, FLIGHT_DATA);
+
+    if (len >= 4 && flight_long(rec->data) == 0xffffffff) {
+        // Connectionless, show the start of the text
+        for (i = 0; i < len - 4 && i < (int) sizeof (text) - 1; i++)
+            text[i] = flight_char(rec->data[4 + i]);
+        text[i] = 0;
+        n += snprintf(line + n, MAX(size - n, 0), ", connectionless \"%s\"", text);
+    } else if (len >= 8) {
+        seq = flight_long(rec->data);
+        ack = flight_long(rec->data + 4);
+        n += snprintf(line + n, MAX(size - n, 0), ", seq %u%s, ack %u%s", seq & ~(1u << 31),
+                seq >> 31 ? " reliable" : "", ack & ~(1u << 31), ack >> 31 ? " reliable" : "");
+        if (rec->out && len >= 10)
+            n += snprintf(line + n, MAX(size - n, 0), ", qport %d", rec->data[8] | rec->data[9] << 8);
+        else if (!rec->out && len > 8)
+            n += snprintf(line + n, MAX(size - n, 0), ", first command %d", rec->data[8]);
+    }
+    if (rec->length > FLIGHT_DATA)
+        n += snprintf(line + n, MAX(size - n, 0), ", first %d kept", FLIGHT_DATA);
+    if (rec->note)
+        snprintf(line + n, MAX(size - n, 0), ", %s at byte %d", rec->note, rec->note_offset);
+}
+
+/*
+==============
+flight_hexdump
+Formats 16 bytes of a recorded datagram starting at offset as hex and
+text. Returns the offset of the next line, or 0 when done.
+==============
+ */
+int flight_hexdump(flight_rec_t *rec, int offset, char *line, int size) {
+    int len = MIN(rec->length, FLIGHT_DATA), i, n;
+
+    n = snprintf(line, size, "  %04x ", offset);
+    for (i = offset; i < offset + 16; i++) {
+        if (i < len)
+            n += snprintf(line + n, MAX(size - n, 0), " %02x", rec->data[i]);
+        else
+            n += snprintf(line + n, MAX(size - n, 0), "   ");
+    }
+    n += snprintf(line + n, MAX(size - n, 0), "  ");
+    for (i = offset; i < offset + 16 && i < len; i++)
+        n += snprintf(line + n, MAX(size - n, 0), "%c", flight_char(rec->data[i]));
+
+    return offset + 16 < len ? offset + 16 : 0;
+}
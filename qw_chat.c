@@ -0,0 +1,147 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "qw_common.h"
+
+/*
+ * IRC to QuakeWorld chat queue. Filled by the IRC side and drained by the
+ * QuakeWorld thread at a pace KTX flood protection accepts. All functions
+ * must be called with qw_mutex held.
+ */
+
+static chatmsg_t chat_queue[CHAT_QUEUE_LEN];
+static int chat_head;                   // Oldest queued message
+static int chat_count;                  // Number of queued messages
+static tokenbucket_t chat_bucket;       // Paces outgoing say commands
+
+/*
+==============
+chat_clear
+Empties the chat queue
+==============
+ */
+void chat_clear(void) {
+    chat_head = chat_count = 0;
+    memset(&chat_bucket, 0, sizeof (chat_bucket));
+}
+
+/*
+==============
+chat_enqueue
+Queues an IRC message to be said in-game. A message is coalesced with an
+earlier one from the same nick if that one hasn't been sent yet.
+Returns false if the queue is full.
+==============
+ */
+bool chat_enqueue(char *nick, char *text) {
+    chatmsg_t *msg;
+    int i, len;
+
+    // Look for an unsent message from the same nick, newest first
+    for (i = chat_count - 1; i >= 0; i--) {
+        msg = &chat_queue[(chat_head + i) % CHAT_QUEUE_LEN];
+        if (strcasecmp(msg->nick, nick))
+            continue;
+        len = strlen(msg->text);
+        if (len + 3 + strlen(text) < sizeof (msg->text)) {
+            snprintf(msg->text + len, sizeof (msg->text) - len, " | %s", text);
+            msg->lines++;
+            return true;
+        }
+        break;
+    }
+
+    if (chat_count == CHAT_QUEUE_LEN)
+        return false;
+
+    msg = &chat_queue[(chat_head + chat_count) % CHAT_QUEUE_LEN];
+    strncpy(msg->nick, nick, sizeof (msg->nick) - 1);
+    msg->nick[sizeof (msg->nick) - 1] = 0;
+    strncpy(msg->text, text, sizeof (msg->text) - 1);
+    msg->text[sizeof (msg->text) - 1] = 0;
+    msg->lines = 1;
+    msg->queued = qw.realtime;
+    msg->stamp = latency_now();
+    chat_count++;
+
+    return true;
+}
+
+/*
+==============
+chat_send
+Says queued messages in-game as fast as the token bucket allows. Messages
+that have waited too long are reported back to IRC instead.
+==============
+ */
+void chat_send(void) {
+    chatmsg_t *msg;
+    char notice[MAX_CHAT_NICK + MAX_CHAT_LEN + 64];
+
+    while (chat_count) {
+        msg = &chat_queue[chat_head];
+
+        if (qw.realtime - msg->queued > CHAT_EXPIRE) {
+            snprintf(notice, sizeof (notice), "Not sent to QuakeWorld due to flood "
+                    "protection: <%s> %s\n", msg->nick, msg->text);
+            qw_to_irc_print(notice, color_statusmessage);
+        } else if (tokenbucket_take(&chat_bucket, qw_chat_interval, qw_chat_burst, qw.realtime)) {
+            netchan.say_stamp = msg->stamp;
+            exec_chat("%s@IRC: %s", msg->nick, msg->text);
+        }
+        else
+            break;
+
+        chat_head = (chat_head + 1) % CHAT_QUEUE_LEN;
+        chat_count--;
+    }
+}
+
+/*
+==============
+chat_report_unsent
+Reports messages still in the queue back to IRC and empties the queue
+==============
+ */
+void chat_report_unsent(void) {
+    char notice[MAX_PRINT_MSG];
+    int i, len;
+
+    if (!chat_count)
+        return;
+
+    len = snprintf(notice, sizeof (notice), "%d queued message(s) were not sent to QuakeWorld, from:", chat_count);
+    for (i = 0; i < chat_count && len < (int) sizeof (notice) - MAX_CHAT_NICK - 2; i++)
+        len += snprintf(notice + len, sizeof (notice) - len, " %s",
+            chat_queue[(chat_head + i) % CHAT_QUEUE_LEN].nick);
+    snprintf(notice + len, sizeof (notice) - len, "\n");
+
+    qw_to_irc_print(notice, color_statusmessage);
+    chat_clear();
+}
+
+/*
+==============
+chat_queued
+Returns the number of messages waiting to be sent. Call with qw_mutex held.
+==============
+ */
+int chat_queued(void) {
+    return chat_count;
+}
@@ -45,6 +45,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <sys/resource.h>
 #include <errno.h>
+#include <time.h>
 
 #include <openssl/sha.h>
 
@@ -69,13 +70,24 @@ typedef unsigned char byte;
  */
 
 #define	QW_HEADER_LEN           8
+#define	QW_QPORT_LEN            2
 #define	MAX_MSG_LEN             1450            // max length of of a network message
+#define	MIN_PATH_MTU            548             // Smallest UDP payload every IPv4 path carries
 #define	MAX_UDP_PACKET          8192
 #define	MAX_PRINT_MSG           4096
 #define	MAX_INFO_STRING         196
 #define	MAX_SERVERINFO_STRING	512
 #define	QW_PROTOCOL_VERSION	28
+#define	UPDATE_BACKUP           64              // Entity frames the server keeps for delta compression
+#define	UPDATE_MASK             (UPDATE_BACKUP - 1)
 #define QW_FPS                  5
+#define KEEPALIVE_MIN           (1000 / QW_FPS) // Keepalive interval while the server has things to say
+#define KEEPALIVE_MAX           1000            // Keepalive interval when idle
+#define CONNECT_RETRY           1000            // Resend unanswered connection requests after this many ms
+#define CONNECT_TIMEOUT         30000           // Drop the connection after this many ms of silence
+#define RATE_MIN                1000            // Lowest rate rate control goes down to (bytes/s)
+#define RATE_PERIOD             10000           // Rate control adjusts the rate this often (ms)
+#define RATE_LOSS               5               // Packet loss percentage that keeps the rate from going down
 
 /*
  * Supported out-of-band network messages
@@ -87,16 +99,26 @@ typedef unsigned char byte;
 #define	OOB_ACK			'l'
 #define	OOB_PRINT		'n'        
 
+/*
+ * svc_print levels
+ */
+
+#define	PRINT_LOW		0               // Pickup messages
+#define	PRINT_MEDIUM		1               // Death messages
+#define	PRINT_HIGH		2               // Critical messages
+#define	PRINT_CHAT		3               // Chat messages
+#define	PRINT_LEVELS		4
+
 /*
  * Eggdrop stuff
  */
 
 #define VER1 1
 #define VER2 1
-bool qw_running;                        // Is the QuakeWorld thread running?
-bool print_ver_info;                    // Print version info on connecting?
+extern bool qw_running;                 // Is the QuakeWorld thread running?
+extern bool print_ver_info;             // Print version info on connecting?
 
-float res_last_calc;                    // When last resource usage calculation was done
+extern float res_last_calc;             // When last resource usage calculation was done
 extern pthread_mutex_t qw_mutex;        // Mutex used to lock shared tcl variables
 
 // Memory management
@@ -114,6 +136,17 @@ extern int qw_rate;                     // Same as "rate" in QuakeWorld
 extern int qw_topcolor;                 // Same as "topcolor" in QuakeWorld
 extern int qw_bottomcolor;              // Same as "bottomcolor" in QuakeWorld
 extern int qw_msgmode;                  // Same as "msg" in QuakeWorld
+extern int qw_chat_interval;            // Milliseconds between say commands in the long run
+extern int qw_chat_burst;               // Say commands allowed back-to-back
+extern char qw_capture_file[MAX_OSPATH]; // Record received datagrams here, if set
+extern char qw_print_filter[64];        // Names of svc_print levels not to relay
+extern char qw_fragfile[MAX_OSPATH];    // Obituaries to recognize, in the fragfile.dat format
+extern int qw_frag_relay;               // Relay recognized obituaries as text too?
+extern int qw_summary_window;           // Seconds of obituaries and pickups summed up in a line, 0 for off
+extern int qw_dedupe_ttl;               // Seconds before a repeated server line is relayed again, 0 for off
+extern int qw_flood_lines;              // Chat lines a player may say in qw_flood_window, 0 for no limit
+extern int qw_flood_window;             // Seconds
+extern char qw_relay_limits[64];        // "class interval burst" for the classes of lines to hold back
 extern char qw_map[40];                 // Current map
 
 extern int color_statusmessage;         // Status message color in IRC
@@ -122,10 +155,10 @@ extern int color_chattext;              // Chat message color in IRC
 extern int color_normaltext;            // Default message color in IRC
 
 // Other shared stuff
-extern void qw_to_irc_print(char* msg, int color);
-extern char irc_msg_buf[MAX_PRINT_MSG]; // Holding area for irc-to-qw chat
+extern void qw_irc_output(int color, char *text); // Sends a line to the IRC channel
+extern char qw_channel[25];             // IRC channel the module is being used on
 extern long qw_maxrss;                  // Amount of memory used by QW thread
-struct rusage qw_rusage;                // QuakeWorld thread resource usage
+extern struct rusage qw_rusage;         // QuakeWorld thread resource usage
 
 /*
  * QuakeWorld connection states
@@ -198,6 +231,7 @@ typedef enum {
     svc_setinfo,        // setinfo on a client
     svc_serverinfo,     // serverinfo
     svc_updatepl,       // [byte] [byte]
+    svc_count
 } svc_t;
 
 // client to server
@@ -212,6 +246,73 @@ typedef enum {
     clc_upload,         // teleport request, spectator only
 } clc_t;
 
+// svc_temp_entity types
+typedef enum {
+    te_spike,           // [coord3]
+    te_superspike,      // [coord3]
+    te_gunshot,         // [byte] count [coord3]
+    te_explosion,       // [coord3]
+    te_tarexplosion,    // [coord3]
+    te_lightning1,      // [short] entity [coord3] start [coord3] end
+    te_lightning2,      // [short] entity [coord3] start [coord3] end
+    te_wizspike,        // [coord3]
+    te_knightspike,     // [coord3]
+    te_lightning3,      // [short] entity [coord3] start [coord3] end
+    te_lavasplash,      // [coord3]
+    te_teleport,        // [coord3]
+    te_blood,           // [byte] count [coord3]
+    te_lightningblood,  // [coord3]
+    te_count
+} tempentity_t;
+
+/*
+ * Usercmd delta bits, see clc_move
+ */
+
+#define	CM_ANGLE1               (1 << 0)
+#define	CM_ANGLE3               (1 << 1)
+#define	CM_FORWARD              (1 << 2)
+#define	CM_SIDE                 (1 << 3)
+#define	CM_UP                   (1 << 4)
+#define	CM_BUTTONS              (1 << 5)
+#define	CM_IMPULSE              (1 << 6)
+#define	CM_ANGLE2               (1 << 7)
+
+/*
+ * Outgoing string command priorities. Higher priorities are packed into
+ * outgoing datagrams first, lower ones wait for the next datagram.
+ */
+
+typedef enum {
+    pri_signon,                         // new, begin etc. Connection management
+    pri_command,                        // Console commands forwarded to the server
+    pri_chat,                           // say
+    pri_count
+} cmdpri_t;
+
+/*
+ * IRC to QuakeWorld chat queue
+ */
+
+#define CHAT_QUEUE_LEN          32              // IRC messages waiting to be said in-game
+#define MAX_CHAT_NICK           32
+#define MAX_CHAT_LEN            240             // Longest text said at once, coalesced lines included
+#define CHAT_EXPIRE             30000           // Queued messages older than this (ms) are dropped
+#define MAX_QUEUED_SAYS         (MAX_MSG_LEN / 7 + 1) // A queued say takes at least 7 bytes
+
+typedef struct {
+    char nick[MAX_CHAT_NICK];
+    char text[MAX_CHAT_LEN];
+    int lines;                          // IRC lines coalesced into this message
+    float queued;                       // Time the first line was queued
+    uint64_t stamp;                     // Same as latency_now(), for latency histograms
+} chatmsg_t;
+
+typedef struct {
+    float tokens;                       // Messages that can be sent right now
+    float last_fill;                    // Time tokens were last added
+} tokenbucket_t;
+
 /*
  * Linked lists for userinfo and serverinfo strings
  */
@@ -222,8 +323,8 @@ typedef struct {
     char value[64];
 } infonode_t;
 
-infonode_t* userinfo_root;              // Root node for userinfo "tree"
-infonode_t* serverinfo_root;            // Root node for serverinfo "tree"
+extern infonode_t* userinfo_root;       // Root node for userinfo "tree"
+extern infonode_t* serverinfo_root;     // Root node for serverinfo "tree"
 
 /*
  * Networking structs
@@ -256,8 +357,18 @@ typedef struct {
         byte rel_flag;                  // Reliability flag of last received reliable message (0/1)
         int remote_acked_seq;           // Last acknowledgement from server
         int remote_acked_rel_flag;      // Last acknowledged reliability flag from server
+        bool reliable;                  // Last received packet carried a reliable message
     } last_recv;
 
+    struct {
+        int received;                   // Packets received in the current sample
+        int dropped;                    // Packets lost in the current sample
+        byte percent;                   // Loss of the last full sample, reported in clc_move
+    } loss;
+
+    int keepalive_interval;             // Current keepalive interval (ms), adapts to traffic
+    float last_move;                    // When the last move command was sent
+
     struct {
         float time;                     // Time last packet was sent
         int seq;                        // Sequence number of last sent packet
@@ -265,10 +376,27 @@ typedef struct {
         byte rel_flag;                  // Reliability flag of last sent reliable message (0/1)
     } last_sent;
 
+    int mtu;                            // Largest datagram payload for the path to the server
+
     // Reliable staging and holding areas
     netbuf_t message; // Writing buffer to send to server
     byte message_buf[MAX_MSG_LEN];
 
+    // Unreliable staging area, packed after the reliable part of the datagram
+    netbuf_t datagram;
+    byte datagram_buf[MAX_MSG_LEN];
+
+    // String commands waiting for room in the reliable message, per priority
+    netbuf_t cmd_queue[pri_count];
+    byte cmd_queue_buf[pri_count][MAX_MSG_LEN];
+
+    // Enqueue times of the says in cmd_queue[pri_chat], oldest first. The
+    // first say_packed of them have been moved on to message.
+    uint64_t say_stamp;                 // Stamp for the next say, 0 if not timed
+    uint64_t say_stamps[MAX_QUEUED_SAYS];
+    int say_count;
+    int say_packed;
+
     int reliable_length;
     byte reliable_buf[MAX_MSG_LEN];     // Unacknowledged reliable message
 
@@ -285,20 +413,593 @@ typedef struct {
     char serverinfo[MAX_SERVERINFO_STRING]; // Serverinfo for the current server
     float connect_time;                     // Time last connection was mode
     float realtime;                         // Current time
+    int valid_sequence;                     // Outgoing sequence of the last entity frame we got, 0 if none
+    int print_filter;                       // svc_print levels skipped this session, a bit each
+    bool frag_relay;                        // Relay obituaries as text this session
+
+    // Kept across reconnects so that they don't need to be redone
+    netadr_t server_adr;                    // Resolved address of server_name
+    char server_name[100];                  // Value of qw_server server_adr was resolved from
+    char userinfo[MAX_INFO_STRING];         // Serialized userinfo sent with connect, "" if stale
+    int rate;                               // Rate in our userinfo, adapted to choke (bytes/s)
+
+    // Rate control
+    float rate_period;                      // When the current adjustment period began
+    int rate_choked;                        // Datagrams with text choked in the current period
+    int rate_floor;                         // Rate is only lowered down to this on the current map
+
+    // Reconnect latency tracking
+    float reconnect_start;                  // Time the current reconnect began, 0 if none
+    float timeout_reconnect;                // Time a reconnect after a timeout began, 0 if none
+    int reconnects;                         // Completed reconnects
+    int reconnect_last;                     // Duration of the last reconnect (ms)
+    int reconnect_max;                      // Longest reconnect (ms)
+    float reconnect_total;                  // Sum of all reconnect durations (ms)
 } game_instance_t;
 
-game_instance_t qw;
-constate_t con_state;
-netchan_t netchan;
+/*
+ * Scoreboard. The QuakeWorld thread updates "scoreboard" in place as
+ * player messages arrive, and copies it to "scoreboard_shared" under
+ * qw_mutex at the end of a frame in which it changed. The IRC side only
+ * reads the copy. Arrays are indexed by player slot.
+ */
+
+#define MAX_CLIENTS             32
+#define MAX_SCOREBOARDNAME      32
+#define MAX_TEAMNAME            16
+
+typedef struct {
+    bool active[MAX_CLIENTS];
+    bool spectator[MAX_CLIENTS];
+    int user_id[MAX_CLIENTS];
+    char name[MAX_CLIENTS][MAX_SCOREBOARDNAME];         // In the QuakeWorld character set
+    char clean_name[MAX_CLIENTS][MAX_SCOREBOARDNAME];   // Readable in IRC
+    char team[MAX_CLIENTS][MAX_TEAMNAME];               // Readable in IRC
+    short frags[MAX_CLIENTS];
+    short ping[MAX_CLIENTS];                            // ms
+    byte pl[MAX_CLIENTS];                               // Packet loss percentage
+    float entertime[MAX_CLIENTS];                       // qw.realtime when the player joined
+    int name_serial;                                    // Bumped whenever the names change
+    bool changed;                                       // Needs publishing
+} scoreboard_t;
+
+extern scoreboard_t scoreboard;
+extern scoreboard_t scoreboard_shared;
+
+/*
+ * Entities. Every server frame is decoded into a flat array of entity
+ * states sorted by entity number, stored in a ring indexed by the sequence
+ * of our packet it answers, like the server keeps them. Delta frames are
+ * applied against an older frame from the ring, new entities against the
+ * baselines. Decoding a frame is a profiler phase of its own, and frames
+ * that take longer than ENTITY_BUDGET are counted.
+ */
+
+#define MAX_EDICTS              512             // Entity numbers are 9 bits
+#define MAX_PACKET_ENTITIES     64              // Entities the server sends in one frame
+#define ENTITY_BUDGET           100000          // Time a frame should decode in (ns)
+
+// Entity delta bits, see svc_packetentities
+#define	U_ORIGIN1               (1 << 9)
+#define	U_ORIGIN2               (1 << 10)
+#define	U_ORIGIN3               (1 << 11)
+#define	U_ANGLE2                (1 << 12)
+#define	U_FRAME                 (1 << 13)
+#define	U_REMOVE                (1 << 14)       // Entity left the frame
+#define	U_MOREBITS              (1 << 15)       // Followed by a byte of the bits below
+#define	U_ANGLE1                (1 << 0)
+#define	U_ANGLE3                (1 << 1)
+#define	U_MODEL                 (1 << 2)
+#define	U_COLORMAP              (1 << 3)
+#define	U_SKIN                  (1 << 4)
+#define	U_EFFECTS               (1 << 5)
+#define	U_SOLID                 (1 << 6)
+
+// Player state bits, see svc_playerinfo
+#define	PF_MSEC                 (1 << 0)
+#define	PF_COMMAND              (1 << 1)
+#define	PF_VELOCITY1            (1 << 2)
+#define	PF_MODEL                (1 << 5)
+#define	PF_SKINNUM              (1 << 6)
+#define	PF_EFFECTS              (1 << 7)
+#define	PF_WEAPONFRAME          (1 << 8)
+#define	PF_DEAD                 (1 << 9)
+#define	PF_GIB                  (1 << 10)
+
+typedef struct {
+    short number;
+    short origin[3];                        // In 1/8 units
+    byte angles[3];                         // In 1/256 turns
+    byte modelindex, frame, colormap, skinnum, effects;
+} entity_state_t;
+
+typedef struct {
+    short origin[3];
+    short flags;                            // PF_ bits
+    byte frame, modelindex, skinnum, effects;
+} player_state_t;
+
+typedef struct {
+    int sequence;                           // Our packet the frame answers
+    bool valid;                             // Complete, can be delta compressed against
+    int num_entities;
+    entity_state_t entities[MAX_PACKET_ENTITIES];
+    uint32_t players;                       // Slots present in "player"
+    player_state_t player[MAX_CLIENTS];
+} entity_frame_t;
+
+extern entity_state_t entity_baselines[MAX_EDICTS];
+extern entity_frame_t entity_frames[UPDATE_BACKUP];
+
+/*
+ * Network traffic counters. Rates are bytes per second over the last
+ * NETSTATS_PERIOD and are shared with the IRC side under qw_mutex.
+ */
+
+#define NETSTATS_PERIOD         5000
+
+typedef struct {
+    int entity_full_bytes;                  // svc_packetentities
+    int entity_delta_bytes;                 // svc_deltapacketentities
+    int entity_slow_frames;                 // Frames that took longer than ENTITY_BUDGET to decode
+
+    // Counter values at the start of the current period
+    struct {
+        float time;
+        uint64_t bytes_in, bytes_out;
+        int entity_full_bytes, entity_delta_bytes;
+    } last;
+
+    int rate_in, rate_out;
+    int rate_entity_full, rate_entity_delta;
+
+    float active_time;                      // Time spent in-game before the current stretch (ms)
+    float active_since;                     // When the current in-game stretch began, 0 if not in-game
+    int active_packets_out;                 // Packets sent while in-game
+    int packets_per_hour;                   // Packets sent per in-game hour
+} netstats_t;
+
+extern netstats_t net_stats;
+
+extern game_instance_t qw;
+extern constate_t con_state;
+extern netchan_t netchan;
     
 extern netbuf_t net_message;
 extern netadr_t net_from;
+extern byte net_message_buffer[MAX_UDP_PACKET];
+
+/*
+ * Latency histograms. Log-linear like HdrHistogram: values below
+ * HIST_SUB are exact, above that each power of two is split into HIST_SUB
+ * buckets, so any value is within 1/HIST_SUB of its bucket. Values are
+ * microseconds. Only the QuakeWorld thread records, and copies them to
+ * "latency_shared" at the end of a frame like the scoreboard. They start
+ * over with each session.
+ */
+
+#define HIST_SUB_BITS           4
+#define HIST_SUB                (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS            ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint32_t count[HIST_BUCKETS];
+    uint32_t total;
+    uint32_t max;
+    uint64_t sum;
+} histogram_t;
+
+typedef struct {
+    histogram_t relay;                      // Datagram received to line handed to IRC
+    histogram_t say;                        // !qsay queued to datagram carrying it sent
+    bool changed;                           // Needs publishing
+} latency_t;
+
+extern latency_t latency;
+extern latency_t latency_shared;
+extern uint64_t net_recv_stamp;             // Receive time of the datagram being parsed, 0 if none
+
+/*
+ * Frame profiler. The QuakeWorld thread is always in exactly one phase,
+ * and the time between phase switches is added to the phase being left.
+ * Output formatting happens in the middle of parsing, so parse time
+ * excludes it. Windows of PROF_WINDOW ms are rolled over at the end of a
+ * frame with qw_mutex held. The IRC side reads "last" and "total".
+ */
+
+#define PROF_WINDOW             60000
+
+typedef enum {
+    prof_idle,                              // Sleeping between frames
+    prof_receive,                           // recvmsg
+    prof_netchan,                           // Netchan headers and out-of-band messages
+    prof_parse,                             // Server messages
+    prof_entities,                          // Entity and player states
+    prof_output,                            // Formatting text for IRC
+    prof_transmit,                          // Keepalive, packing, (re)transmit
+    prof_mutex,                             // Waiting for qw_mutex
+    prof_rusage,                            // getrusage
+    prof_other,                             // Everything else
+    prof_count
+} profphase_t;
+
+typedef struct {
+    uint64_t time[prof_count];              // Time spent in each phase (ns)
+    uint64_t max[prof_count];               // Longest single stay in a phase (ns)
+    uint32_t calls[prof_count];             // Times each phase was entered
+    uint32_t frames;
+    uint64_t frame_max;                     // Longest frame without the idle part (ns)
+    uint64_t elapsed;                       // Length of the window (ns)
+} profwindow_t;
+
+typedef struct {
+    profwindow_t current, last, total;
+} profiler_t;
+
+extern profiler_t profiler;
+
+/*
+ * Metrics registry. Counters are only ever added to. The QuakeWorld thread
+ * owns a block of them and updates it without atomic operations, other
+ * threads share a block updated atomically. Readers add the blocks up.
+ * metrics_write() also samples gauges and the latency histograms, and
+ * writes everything in the Prometheus text format.
+ */
+
+// What kind of line was relayed to IRC, by the color it was printed with
+typedef enum {
+    relay_status,
+    relay_normal,
+    relay_centerprint,
+    relay_chat,
+    relay_count
+} relayclass_t;
+
+extern const char *relay_class_names[relay_count];
+
+// What kind of death an obituary told of
+typedef enum {
+    kill_frag,
+    kill_teamkill,
+    kill_suicide,
+    kill_death,                             // Nobody to blame, e.g. lava
+    kill_count
+} killkind_t;
+
+extern const char *kill_kind_names[kill_count];
+
+typedef enum {
+    metric_packets_in,
+    metric_packets_out,
+    metric_bytes_in,
+    metric_bytes_out,
+    metric_reconnects,
+    metric_retransmits,                     // Reliable messages sent again
+    metric_choked,                          // Datagrams the server skipped to keep to our rate
+    metric_kills,                           // Obituaries recognized, one per killkind_t
+    metric_relayed = metric_kills + kill_count, // Lines sent to IRC, one per relayclass_t
+    metric_deduped = metric_relayed + relay_count, // Lines seen again too soon, one per relayclass_t
+    metric_limited = metric_deduped + relay_count, // Lines over the class's rate limit, one per relayclass_t
+    metric_flooded = metric_limited + relay_count, // Chat lines held back from flooding players
+    metric_filtered,                        // svc_print messages skipped, one per level
+    metric_svc = metric_filtered + PRINT_LEVELS, // Server messages, one per svc_t and one for unknown
+    metric_count = metric_svc + svc_count + 1
+} metric_t;
+
+/*
+ * Aho-Corasick automaton, a DFA that finds any of a set of patterns in a
+ * text in one pass. Only characters that occur in the patterns have a
+ * column of their own, column 0 is for the rest. Step with
+ * AUTOMATON_NEXT() from state 0, and walk the output links of each state
+ * entered to find every pattern that ends there.
+ */
+
+typedef struct {
+    int states;
+    int width;                              // Alphabet size
+    byte map[256];                          // Character to column
+    uint16_t *next;                         // Transitions, width per state
+    int16_t *pattern;                       // Pattern that ends in a state, or -1
+    uint16_t *output;                       // Next state down the failure chain where a pattern ends, or 0
+} automaton_t;
+
+#define AUTOMATON_NEXT(a, state, c)     ((a)->next[(state) * (a)->width + (a)->map[(byte) (c)]])
+
+/*
+ * Message filter. The TCL command qwfilter keeps the rules in
+ * "filter_rules" under qw_mutex. The thread relaying text compiles them
+ * into one Aho-Corasick automaton, a DFA over the characters that occur in
+ * the patterns, and runs each line through it once. Patterns match
+ * anywhere in a line, ignoring case. A rule applies to lines of the relay
+ * classes it names.
+ */
+
+#define MAX_FILTER_RULES        32              // One bit each in a match mask
+#define MAX_FILTER_PATTERN      64
+
+typedef enum {
+    filter_suppress,                        // Don't relay the line
+    filter_start,                           // Don't relay the line nor the ones after it...
+    filter_end,                             // ...until this one, which is relayed again
+    filter_route,                           // Relay the line as another class
+    filter_count
+} filteraction_t;
+
+typedef struct {
+    filteraction_t action;
+    int classes;                            // A bit per relayclass_t the rule applies to
+    relayclass_t route;                     // Where filter_route sends the line
+    char pattern[MAX_FILTER_PATTERN];
+} filterrule_t;
+
+typedef struct {
+    filterrule_t rule[MAX_FILTER_RULES];
+    int count;
+    bool changed;                           // Needs compiling
+} filterrules_t;
+
+extern filterrules_t filter_rules;
+
+/*
+ * Obituaries. A fragfile, in the ezQuake fragfile.dat format, lists the
+ * death messages of a mod as the text that follows the first name and,
+ * for messages naming two players, the text that follows the second. The
+ * first texts are compiled into an automaton, and each line of
+ * PRINT_MEDIUM text is matched in one pass. A recognized line becomes a
+ * kill event. The QuakeWorld thread keeps the latest events in "frag_log"
+ * and copies it to "frag_log_shared" like the scoreboard.
+ */
+
+#define MAX_OBITUARIES          256
+#define MAX_OBITUARY_MSG        64
+#define MAX_WEAPON_CLASSES      64
+#define MAX_WEAPON_NAME         16
+#define FRAG_LOG_SIZE           64
+
+// Obituary types in the order of their fragfile names
+typedef enum {
+    obit_death,                             // X died
+    obit_suicide,                           // X killed themselves
+    obit_frags_unknown,                     // X killed someone
+    obit_teamkills_unknown,                 // X killed a teammate
+    obit_teamkilled_unknown,                // X was killed by a teammate
+    obit_fragged_by,                        // X was killed by Y
+    obit_frags,                             // X killed Y
+    obit_teamkilled_by,                     // X was killed by teammate Y
+    obit_teamkills,                         // X killed teammate Y
+    obit_count
+} obituarytype_t;
+
+typedef struct {
+    killkind_t kind;
+    char killer[MAX_SCOREBOARDNAME];        // "" if nobody or not named
+    char victim[MAX_SCOREBOARDNAME];        // "" if not named
+    int killer_slot;                        // -1 if nobody or not on the scoreboard
+    int victim_slot;
+    char weapon[MAX_WEAPON_NAME];           // Weapon class, "" if the fragfile has none
+    float time;                             // qw.realtime
+} killevent_t;
+
+typedef struct {
+    killevent_t event[FRAG_LOG_SIZE];       // Ring, the oldest is overwritten
+    int count;                              // Events logged this session
+    bool changed;                           // Needs publishing
+} fraglog_t;
+
+extern fraglog_t frag_log;
+extern fraglog_t frag_log_shared;
+
+/*
+ * Event summaries. With qw_summary_window set, obituaries recognized with
+ * the fragfile and item pickups aren't relayed one by one. They are
+ * counted per player over a window, and a single line sums each window
+ * up. How long the window is and what the line tells follow the match
+ * state KTX keeps in the "status" serverinfo key.
+ */
+
+#define SUMMARY_PREWAR_SCALE    4               // Prewar windows are this many times longer
+#define SUMMARY_TOP             3               // Players named in a match summary
+
+typedef enum {
+    match_unknown,                          // No status, e.g. not KTX
+    match_prewar,                           // "Standby"
+    match_countdown,                        // "Countdown"
+    match_playing                           // Time left, e.g. "12 min left"
+} matchstate_t;
+
+typedef struct {
+    matchstate_t state;
+    int window;                             // qw_summary_window this map (s), 0 if off
+    float start;                            // qw.realtime the first event of the window came
+    short frags[MAX_CLIENTS];               // Frags gained in the window, by slot
+    int kills;                              // Kill events in the window
+    int pickups;                            // Pickup messages in the window
+} summary_t;
+
+extern summary_t summary;
+
+/*
+ * Duplicate suppression and rate limits for lines on their way to IRC.
+ * Server text, i.e. high level prints and centerprints, is hashed, and a
+ * line seen again before its entry in the cache expires isn't relayed.
+ * Each class can also be held to a token bucket, set with qw_relay_limits.
+ */
+
+#define DEDUPE_SLOTS            512             // Lines remembered, a power of two
+#define DEDUPE_PROBES           8               // Slots looked at for a line
+
+typedef struct {
+    uint64_t hash;                          // 0 if the slot was never used
+    float expires;                          // qw.realtime the line may be relayed again
+} dedupeentry_t;
+
+typedef struct {
+    int interval;                           // ms per line in the long run, 0 for no limit
+    int burst;                              // Lines that can go back-to-back
+} relaylimit_t;
+
+typedef struct {
+    dedupeentry_t entry[DEDUPE_SLOTS];
+    int ttl;                                // qw_dedupe_ttl this map (ms)
+    relaylimit_t limit[relay_count];        // Read from qw_relay_limits when a map starts
+    tokenbucket_t bucket[relay_count];
+} dedupe_t;
+
+extern dedupe_t dedupe;
+
+/*
+ * Chat flood detection. Each chat line is put down to a player by
+ * matching the "name: " it starts with against a trie of the names on
+ * the scoreboard. A player who says more than qw_flood_lines lines in
+ * qw_flood_window seconds has the rest held back, counted in a sliding
+ * window of the times of their latest lines, until they slow down. Then
+ * one line tells how many were held back.
+ */
+
+#define MAX_FLOOD_LINES         16
+#define FLOOD_TRIE_NODES        (MAX_CLIENTS * MAX_SCOREBOARDNAME + 1)
+
+typedef struct {
+    byte c;
+    int8_t slot;                            // Player whose name ends here, or -1
+    uint16_t child;                         // First node one character further, 0 if none
+    uint16_t sibling;                       // Next node with the same parent, 0 if none
+} trienode_t;
+
+typedef struct {
+    trienode_t trie[FLOOD_TRIE_NODES];      // Node 0 is the root
+    int nodes;
+    int name_serial;                        // scoreboard.name_serial the trie was built from
+    int lines;                              // qw_flood_lines this map, 0 if off
+    int window;                             // qw_flood_window this map (ms)
+    float times[MAX_CLIENTS][MAX_FLOOD_LINES]; // Ring of the times of each player's latest lines
+    int next[MAX_CLIENTS];                  // Oldest time in the ring, replaced next
+    int held[MAX_CLIENTS];                  // Lines held back since the last notice
+    char name[MAX_CLIENTS][MAX_SCOREBOARDNAME]; // Who they were from
+} flood_t;
+
+extern flood_t flood;
+
+/*
+ * Scrollback. The QuakeWorld thread keeps the latest lines relayed to IRC
+ * in a ring of fixed-size entries, and copies the new ones to
+ * "scrollback_shared" at the end of each frame for !qlast.
+ */
+
+#define SCROLLBACK_SIZE         64
+#define SCROLLBACK_TEXT         400         // Longer lines are cut short
+
+typedef struct {
+    relayclass_t class;
+    time_t time;                            // When it was relayed
+    char text[SCROLLBACK_TEXT];             // Cleaned text, on one line
+} scrollentry_t;
+
+typedef struct {
+    scrollentry_t entry[SCROLLBACK_SIZE];   // Ring, the oldest is overwritten
+    int count;                              // Lines kept this session
+} scrollback_t;
+
+extern scrollback_t scrollback;
+extern scrollback_t scrollback_shared;
+
+/*
+ * Memory accounting. Everything the module takes from the heap goes
+ * through qw_malloc() with a tag naming the subsystem, and each tag keeps
+ * its live bytes and high-water mark. Sizes include the small header used
+ * to find the size again in qw_free(), so the sum matches what nmalloc()
+ * handed out. Counters are updated atomically, either thread may allocate.
+ */
+
+typedef enum {
+    mem_infostring,                         // Slab chunks for infonodes
+    mem_arena,                              // Arena requests that didn't fit
+    mem_filter,                             // Compiled message filter
+    mem_frags,                              // Compiled obituaries
+    mem_count
+} memtag_t;
+
+typedef struct {
+    long live;                              // Bytes allocated now
+    long peak;                              // Most bytes ever allocated at once
+    long allocs;                            // Allocations made
+} memstat_t;
+
+extern memstat_t mem_stats[mem_count];
+extern memstat_t mem_total;                 // All tags together
+extern const char *mem_tag_names[mem_count];
+
+/*
+ * Per-thread bump arena for data that doesn't outlive the function that
+ * allocated it. Take a mark with arena_mark() and hand it back to
+ * arena_release() when done, qw_frame() also releases everything at the
+ * start of each frame. Requests that don't fit come from the heap and are
+ * freed on release, so the arena never fails.
+ */
+
+#define ARENA_SIZE              16384
+
+extern long arena_peak;                     // Most arena bytes used at once by any thread
+
+/*
+ * Slabs of fixed-size objects for long-lived nodes. Freed objects are
+ * kept for reuse, and the chunks go back to the heap once all of the
+ * objects are free.
+ */
+
+#define SLAB_CHUNK_OBJECTS      32
+
+typedef struct {
+    int size;                               // Object size
+    memtag_t tag;
+    void *free_list;                        // Free objects, linked through their first bytes
+    void *chunks;                           // Chunks, linked through their first bytes
+    int live;                               // Objects in use
+} slab_t;
+
+/*
+ * Packet capture file records
+ */
+
+#define CAPTURE_MAGIC           "QWCAP01"
+
+typedef struct {
+    uint64_t time;                      // Monotonic receive time (ns)
+    uint32_t ip;                        // Source address, network byte order
+    uint16_t port;                      // Source port, network byte order
+    uint16_t length;                    // Length of the datagram that follows
+} capture_rec_t;
+
+extern bool capture_replaying;
+
+/*
+ * Flight recorder: the last FLIGHT_RECORDS datagrams in both directions,
+ * kept in memory at all times and decoded only when someone asks. Only the
+ * QuakeWorld thread records. A slot's serial is FLIGHT_WRITING while it is
+ * being written, and readers check it before and after copying a record
+ * out, so no lock is needed.
+ */
+
+#define FLIGHT_RECORDS          64
+#define FLIGHT_DATA             1536    // Longer datagrams are cut short
+#define FLIGHT_WRITING          0xffffffff
+
+typedef struct {
+    uint64_t time;                      // Monotonic time (ns)
+    uint32_t serial;                    // Datagrams recorded before this one
+    bool out;                           // Sent by us?
+    char *note;                         // Set when the datagram caused trouble
+    int note_offset;                    // Read position when the note was made
+    int length;                         // Length of the whole datagram
+    byte data[FLIGHT_DATA];
+} flight_rec_t;
 
 /*
  * qw_main.c functions
  */
 
 void *qw_init(void *arg);
+void qw_session_clear(void);
 void qw_frame();
 
 /*
@@ -307,18 +1008,31 @@ void qw_frame();
 
 void con_init(int port);
 void con_clear(void);
+void con_set_state(constate_t state);
 void udp_transmit(int length, void *data, netadr_t to);
 bool udp_process(void);
+void udp_wait(int msec);
 bool netadr_compare(netadr_t a, netadr_t b);
+int netadr_path_mtu(netadr_t a);
 
 void net_oob_transmit(netadr_t adr, int length, char *data);
 void net_oob_process(void);
 
+bool net_resolve_server(netadr_t *adr);
 void net_request_challenge(void);
 void net_reconnect(void);
+void net_reconnect_begin(void);
+void net_reconnect_end(void);
 void net_disconnect(void);
 
+void netchan_setup(netchan_t *chan, netadr_t adr, int qport);
 void netchan_keepalive(void);
+bool netchan_keepalive_due(netchan_t *chan);
+void netstats_update(void);
+void rate_update(void);
+void netchan_stringcmd(netchan_t *chan, cmdpri_t pri, char *cmd);
+void netchan_pack(netchan_t *chan);
+void netchan_says_sent(netchan_t *chan, bool sent);
 void netchan_transmit(netchan_t *chan, int length, byte *data);
 bool netchan_process(netchan_t *chan);
 
@@ -327,23 +1041,27 @@ int net_console_execute(char *cmd_str);
 void exec_serverdata(void);
 void exec_stufftext(char *stuff_cmd);
 void exec_sound(void);
+void exec_temp_entity(void);
 void exec_rcon(char* cmd);
 void exec_packet(void);
 void exec_fullserverinfo(void);
 void exec_updateuserinfo(void);
-void exec_setinfo(infonode_t* node);
+void exec_setinfo(void);
+void exec_serverinfo(void);
+void exec_centerprint(char *text);
 void exec_chat(char *fmt, ...);
 
 /*
  * qw_utils.c functions
  */
 
-int net_read_count;
-bool net_read_err;
+extern int net_read_count;
+extern bool net_read_err;
 
 void net_begin_read(void);
 int net_read_bytes(int bytes);
 char *net_read_string(bool break_on_nl);
+void net_skip_string(void);
 void net_write_integer(netbuf_t *nb, int c, int bytes);
 void net_write_string(netbuf_t *nb, char *s);
 void net_skip_message();
@@ -358,12 +1076,15 @@ void buf_write(netbuf_t *buf, void *data, int length);
 void infostring_init(void);
 infonode_t* infostring_add_node(infonode_t* pos, char* key, char* val);
 void infostring_update_node(infonode_t* pos, char* key, char* val);
-void infostring_print(infonode_t* pos, char* istr);
+void infostring_print(infonode_t* pos, char* istr, int size);
 void infostring_from_string(infonode_t* pos, char *info);
 void infostring_clear(infonode_t* pos, bool free_root);
+bool infostring_value(char *info, char *key, char *value, int size);
 bool infostring_check_input(char* key, char* value);
 
+bool tokenbucket_take(tokenbucket_t *tb, int interval, int burst, float now);
 short byteswap_short(short number);
+byte sequence_crc_byte(byte *data, int length, int sequence);
 char *bin2hex(unsigned char *d);
 int get_time(void);
 
@@ -377,5 +1098,171 @@ int parser_argc(void);
 void parser_tokenize(char *text, bool macro_expand);
 char *strnstr(char *haystack, int hlen, char *needle);
 
+/*
+ * qw_stats.c functions
+ */
+
+uint64_t latency_now(void);
+void latency_record(histogram_t *h, uint64_t stamp);
+void latency_clear(void);
+void latency_publish(void);
+void histogram_add(histogram_t *h, uint32_t value);
+uint32_t histogram_percentile(histogram_t *h, float percentile);
+uint32_t histogram_count_below(histogram_t *h, uint32_t value);
+uint64_t prof_clock(void);
+void prof_start(void);
+int prof_enter(int phase);
+void prof_frame(void);
+void qw_mutex_lock(void);
+
+/*
+ * qw_scoreboard.c functions
+ */
+
+void scoreboard_clear(void);
+void scoreboard_userinfo(int slot, int user_id, char *info);
+void scoreboard_setinfo(int slot, char *key, char *value);
+void scoreboard_publish(void);
+void scoreboard_players(scoreboard_t *sb, char *line, int size);
+void scoreboard_scores(scoreboard_t *sb, char *line, int size);
+int scoreboard_teams(scoreboard_t *sb, char *line, int size);
+
+/*
+ * qw_entities.c functions
+ */
+
+void entities_clear(void);
+void entities_baseline(void);
+void entities_static(void);
+void entities_playerinfo(void);
+void entities_parse(bool delta);
+
+/*
+ * qw_metrics.c functions
+ */
+
+void metrics_thread_start(void);
+void metric_add(metric_t metric, uint64_t n);
+uint64_t metric_value(metric_t metric);
+bool metrics_write(char *path);
+
+/*
+ * qw_mem.c functions
+ */
+
+void *qw_malloc(memtag_t tag, int size);
+void qw_free(void *pointer);
+long mem_session(void);
+void *arena_alloc(int size);
+int arena_mark(void);
+void arena_release(int mark);
+void *slab_alloc(slab_t *slab);
+void slab_free(slab_t *slab, void *object);
+
+/*
+ * qw_print.c functions
+ */
+
+extern char qw_char_tbl[256];           // QuakeWorld character set to plain text
+extern const char *print_level_names[PRINT_LEVELS];
+
+void qw_to_irc_print(char* msg, int color);
+void qw_cleantext_init(void);
+void qw_cleantext(char *text);
+int print_filter_parse(char *names);
+void qw_to_irc_print_level(char *msg, int level);
+
+/*
+ * qw_automaton.c functions
+ */
+
+bool automaton_build(automaton_t *a, char **patterns, int count, bool fold_case, memtag_t tag);
+void automaton_free(automaton_t *a);
+
+/*
+ * qw_filter.c functions
+ */
+
+void filter_defaults(void);
+void filter_clear(void);
+char *filter_add(char *action, char *classes, char *pattern, char *route);
+void filter_describe(int index, char *line, int size);
+void filter_update(void);
+void filter_reset(void);
+bool filter_line(char *line, relayclass_t *class);
+
+/*
+ * qw_frags.c functions
+ */
+
+bool frags_load(char *path);
+void frags_clear(void);
+bool frags_line(char *line);
+void frags_publish(void);
+
+/*
+ * qw_summary.c functions
+ */
+
+void summary_clear(void);
+void summary_status(char *status);
+bool summary_active(void);
+void summary_kill(killevent_t *event);
+bool summary_pickup(void);
+void summary_flush(void);
+void summary_frame(void);
+
+/*
+ * qw_dedupe.c functions
+ */
+
+void dedupe_clear(void);
+void dedupe_limits_parse(char *limits);
+bool dedupe_line(char *line, relayclass_t class, int level);
+
+/*
+ * qw_flood.c functions
+ */
+
+void flood_clear(void);
+bool flood_line(char *line);
+void flood_frame(void);
+void flood_flush(void);
+
+/*
+ * qw_scrollback.c functions
+ */
+
+void scrollback_clear(void);
+void scrollback_add(relayclass_t class, char *text);
+void scrollback_publish(void);
+int scrollback_latest(scrollback_t *sb, relayclass_t class, int *index, int max);
+
+/*
+ * qw_chat.c functions
+ */
+
+void chat_clear(void);
+bool chat_enqueue(char *nick, char *text);
+void chat_send(void);
+void chat_report_unsent(void);
+int chat_queued(void);
+
+/*
+ * qw_capture.c functions
+ */
+
+bool capture_open(char *path);
+void capture_close(void);
+void capture_write(void);
+void capture_replay_output(char *line);
+int capture_replay(char *path, FILE *out, float *elapsed);
+void flight_thread_start(void);
+void flight_record(bool out, void *data, int length);
+void flight_note(char *note);
+bool flight_get(int back, flight_rec_t *rec);
+void flight_describe(flight_rec_t *rec, uint64_t now, char *line, int size);
+int flight_hexdump(flight_rec_t *rec, int offset, char *line, int size);
+
 #endif	/* QW_COMMON_H */
 
@@ -0,0 +1,135 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Repeated lines and classes of lines over their rate limit are kept from
+ * IRC
+ */
+
+dedupe_t dedupe;
+
+/*
+==============
+dedupe_clear
+Forgets the lines of the previous session
+==============
+ */
+void dedupe_clear(void) {
+    memset(&dedupe, 0, sizeof (dedupe));
+}
+
+/*
+==============
+dedupe_limits_parse
+Reads rate limits from groups of "class interval burst", e.g.
+"centerprint 3000 2" for one centerprint every three seconds with two
+back-to-back. Classes not named aren't limited.
+==============
+ */
+void dedupe_limits_parse(char *limits) {
+    char list[64], *name, *interval, *burst, *save;
+    int class;
+
+    memset(dedupe.limit, 0, sizeof (dedupe.limit));
+    strncpy(list, limits, sizeof (list) - 1);
+    list[sizeof (list) - 1] = 0;
+    for (name = strtok_r(list, " ,", &save); name; name = strtok_r(NULL, " ,", &save)) {
+        for (class = 0; class < relay_count && strcasecmp(name, relay_class_names[class]); class++);
+        if (class == relay_count) {
+            printf("Error: Unknown relay class '%s'. (dedupe_limits_parse())\n", name);
+            return;
+        }
+        interval = strtok_r(NULL, " ,", &save);
+        burst = strtok_r(NULL, " ,", &save);
+        if (!interval || !burst) {
+            printf("Error: Rate limit of %s needs an interval and a burst. (dedupe_limits_parse())\n", name);
+            return;
+        }
+        dedupe.limit[class].interval = atoi(interval);
+        dedupe.limit[class].burst = atoi(burst);
+    }
+}
+
+/*
+==============
+dedupe_hash
+Polynomial rolling hash of a line, leaving out the newline. Never 0, which
+marks an unused slot.
+==============
+ */
+static uint64_t dedupe_hash(char *line) {
+    uint64_t hash = 0;
+
+    for (; *line && *line != '\n'; line++)
+        hash = hash * 1099511628211ULL + (byte) *line;
+    return hash ? hash : 1;
+}
+
+/*
+==============
+dedupe_seen
+Tells if a line was relayed less than ttl ms ago, and remembers it
+otherwise. A line takes the first free or expired slot of those it may
+go to, or the one that expires soonest.
+==============
+ */
+static bool dedupe_seen(char *line, int ttl) {
+    uint64_t hash = dedupe_hash(line);
+    dedupeentry_t *entry, *victim = NULL;
+    int i;
+
+    for (i = 0; i < DEDUPE_PROBES; i++) {
+        entry = &dedupe.entry[(hash + i) & (DEDUPE_SLOTS - 1)];
+        if (entry->hash == hash && entry->expires > qw.realtime)
+            return true;
+        if (!victim || entry->expires < victim->expires)
+            victim = entry;
+    }
+
+    victim->hash = hash;
+    victim->expires = qw.realtime + ttl;
+    return false;
+}
+
+/*
+==============
+dedupe_line
+Runs a complete line through the cache and the class's rate limit.
+Returns false if the line isn't to be relayed. Only server text, high
+level prints and centerprints, is taken for repeats: obituaries, pickups
+and chat repeat for good reason. "level" is the svc_print level, or -1.
+==============
+ */
+bool dedupe_line(char *line, relayclass_t class, int level) {
+    relaylimit_t *limit = &dedupe.limit[class];
+
+    if (dedupe.ttl > 0 && (level == PRINT_HIGH || (level < 0 && class == relay_centerprint))
+            && dedupe_seen(line, dedupe.ttl)) {
+        metric_add(metric_deduped + class, 1);
+        return false;
+    }
+    if (limit->interval > 0 && !tokenbucket_take(&dedupe.bucket[class], limit->interval, limit->burst, qw.realtime)) {
+        metric_add(metric_limited + class, 1);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,285 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Entity and player states from svc_packetentities,
+ * svc_deltapacketentities, svc_playerinfo and svc_spawnbaseline
+ */
+
+entity_state_t entity_baselines[MAX_EDICTS];
+entity_frame_t entity_frames[UPDATE_BACKUP];
+
+/*
+==============
+entities_clear
+Forgets the baselines and frames of the previous level
+==============
+ */
+void entities_clear(void) {
+    memset(entity_baselines, 0, sizeof (entity_baselines));
+    memset(entity_frames, 0, sizeof (entity_frames));
+}
+
+/*
+==============
+entities_frame
+Returns the frame the packet being parsed belongs to. Player states come
+before the entities, so whichever arrives first starts the frame.
+==============
+ */
+static entity_frame_t *entities_frame(void) {
+    int sequence = netchan.last_recv.remote_acked_seq;
+    entity_frame_t *frame = &entity_frames[sequence & UPDATE_MASK];
+
+    if (frame->sequence != sequence) {
+        frame->sequence = sequence;
+        frame->valid = false;
+        frame->num_entities = 0;
+        frame->players = 0;
+    }
+    return frame;
+}
+
+/*
+==============
+entities_read_state
+Reads the state of an entity as sent in svc_spawnbaseline and
+svc_spawnstatic
+==============
+ */
+static void entities_read_state(entity_state_t *state) {
+    int i;
+
+    state->modelindex = net_read_bytes(1);
+    state->frame = net_read_bytes(1);
+    state->colormap = net_read_bytes(1);
+    state->skinnum = net_read_bytes(1);
+    for (i = 0; i < 3; i++) {
+        state->origin[i] = net_read_bytes(2);
+        state->angles[i] = net_read_bytes(1);
+    }
+}
+
+/*
+==============
+entities_baseline
+Parses svc_spawnbaseline, the state new entities are delta compressed
+against
+==============
+ */
+void entities_baseline(void) {
+    entity_state_t state = {0};
+    int number;
+
+    number = net_read_bytes(2);
+    entities_read_state(&state);
+    if (number < 0 || number >= MAX_EDICTS || net_read_err)
+        return;
+
+    state.number = number;
+    entity_baselines[number] = state;
+}
+
+/*
+==============
+entities_static
+Parses svc_spawnstatic. Static entities never change, so they aren't kept.
+==============
+ */
+void entities_static(void) {
+    entity_state_t state;
+
+    entities_read_state(&state);
+}
+
+/*
+==============
+entities_read_delta
+Reads the changes to an entity's state. "from" is the baseline or the
+entity's state in the frame delta compressed against.
+==============
+ */
+static void entities_read_delta(entity_state_t *from, entity_state_t *to, int bits) {
+    *to = *from;
+    to->number = bits & (MAX_EDICTS - 1);
+    // The low bits are the entity number, the rest are in the next byte
+    bits &= ~(MAX_EDICTS - 1);
+    if (bits & U_MOREBITS)
+        bits |= net_read_bytes(1);
+
+    if (bits & U_MODEL)
+        to->modelindex = net_read_bytes(1);
+    if (bits & U_FRAME)
+        to->frame = net_read_bytes(1);
+    if (bits & U_COLORMAP)
+        to->colormap = net_read_bytes(1);
+    if (bits & U_SKIN)
+        to->skinnum = net_read_bytes(1);
+    if (bits & U_EFFECTS)
+        to->effects = net_read_bytes(1);
+    if (bits & U_ORIGIN1)
+        to->origin[0] = net_read_bytes(2);
+    if (bits & U_ANGLE1)
+        to->angles[0] = net_read_bytes(1);
+    if (bits & U_ORIGIN2)
+        to->origin[1] = net_read_bytes(2);
+    if (bits & U_ANGLE2)
+        to->angles[1] = net_read_bytes(1);
+    if (bits & U_ORIGIN3)
+        to->origin[2] = net_read_bytes(2);
+    if (bits & U_ANGLE3)
+        to->angles[2] = net_read_bytes(1);
+}
+
+/*
+==============
+entities_add
+Appends an entity to a frame. Returns false if the frame is full.
+==============
+ */
+static bool entities_add(entity_frame_t *frame, entity_state_t *state) {
+    if (frame->num_entities == MAX_PACKET_ENTITIES)
+        return false;
+    frame->entities[frame->num_entities++] = *state;
+    return true;
+}
+
+/*
+==============
+entities_parse
+Parses svc_packetentities and svc_deltapacketentities. Both list changed
+entities by ascending number, and a delta frame leaves out the ones that
+didn't change from the old frame. The two sorted lists are merged. A frame
+that can't be decoded completely is still read to its end so that the
+rest of the packet gets parsed, but it's not delta compressed against, and
+the server is asked for a full update instead.
+==============
+ */
+void entities_parse(bool delta) {
+    int phase = prof_enter(prof_entities);
+    uint64_t start = prof_clock();
+    entity_frame_t *frame = entities_frame(), *from = NULL;
+    entity_state_t state;
+    int word, number, old = 0, from_seq;
+    bool complete = true;
+
+    frame->num_entities = 0;
+    frame->valid = false;
+
+    if (delta) {
+        from_seq = net_read_bytes(1);
+        from = &entity_frames[from_seq & UPDATE_MASK];
+        // The old frame must be the one the server means, and recent
+        // enough that it hasn't been overwritten
+        if (!from->valid || (from->sequence & 255) != from_seq
+                || netchan.last_sent.seq - from->sequence >= UPDATE_BACKUP - 1) {
+            from = NULL;
+            complete = false;
+        }
+    }
+
+    while ((word = net_read_bytes(2)) > 0) {
+        number = word & (MAX_EDICTS - 1);
+
+        // Entities left out before this one didn't change
+        while (from && old < from->num_entities && from->entities[old].number < number)
+            complete &= entities_add(frame, &from->entities[old++]);
+
+        if (from && old < from->num_entities && from->entities[old].number == number) {
+            old++;
+            if (word & U_REMOVE)
+                continue;
+            entities_read_delta(&from->entities[old - 1], &state, word);
+        } else {
+            if (word & U_REMOVE)
+                continue;
+            entities_read_delta(&entity_baselines[number], &state, word);
+        }
+        if (net_read_err)
+            break;
+        complete &= entities_add(frame, &state);
+    }
+
+    // The rest didn't change either
+    while (from && old < from->num_entities)
+        complete &= entities_add(frame, &from->entities[old++]);
+
+    frame->valid = complete && !net_read_err;
+    qw.valid_sequence = frame->valid ? frame->sequence : 0;
+
+    if (prof_clock() - start > ENTITY_BUDGET)
+        net_stats.entity_slow_frames++;
+    prof_enter(phase);
+}
+
+/*
+==============
+entities_playerinfo
+Parses svc_playerinfo, the state of one player in the frame
+==============
+ */
+void entities_playerinfo(void) {
+    int phase = prof_enter(prof_entities);
+    entity_frame_t *frame = entities_frame();
+    player_state_t state;
+    int slot, bits, i;
+
+    memset(&state, 0, sizeof (state));
+    slot = net_read_bytes(1);
+    state.flags = net_read_bytes(2);
+    for (i = 0; i < 3; i++)
+        state.origin[i] = net_read_bytes(2);
+    state.frame = net_read_bytes(1);
+
+    if (state.flags & PF_MSEC)
+        net_skip_bytes(1);
+
+    // The last move the player made, only the size matters here
+    if (state.flags & PF_COMMAND) {
+        bits = net_read_bytes(1);
+        for (i = 0; i < 8; i++) {
+            if (!(bits & (1 << i)))
+                continue;
+            net_skip_bytes((1 << i) & (CM_BUTTONS | CM_IMPULSE) ? 1 : 2);
+        }
+        net_skip_bytes(1);
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (state.flags & (PF_VELOCITY1 << i))
+            net_skip_bytes(2);
+    }
+    if (state.flags & PF_MODEL)
+        state.modelindex = net_read_bytes(1);
+    if (state.flags & PF_SKINNUM)
+        state.skinnum = net_read_bytes(1);
+    if (state.flags & PF_EFFECTS)
+        state.effects = net_read_bytes(1);
+    if (state.flags & PF_WEAPONFRAME)
+        net_skip_bytes(1);
+
+    if (slot >= 0 && slot < MAX_CLIENTS && !net_read_err) {
+        frame->player[slot] = state;
+        frame->players |= 1u << slot;
+    }
+    prof_enter(phase);
+}
@@ -0,0 +1,738 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+#include <signal.h>
+
+/*
+ * A stand-in QuakeWorld server for load testing the module on one machine.
+ *
+ * It speaks just enough of the protocol to take one client through the
+ * challenge, connect and signon, and then generates chat, frag messages,
+ * centerprints, entity updates and effects at the requested rates. Like a real
+ * server it only sends a datagram in reply to one from the client, so how
+ * often the client asks decides how fast it hears of the game. Outgoing
+ * datagrams can be dropped on purpose to simulate packet loss.
+ */
+
+#define FAKESRV_TIMEOUT         10.0    // Drop a silent client after this many seconds
+#define FAKESRV_REPORT          5.0     // Seconds between statistics lines
+#define FAKESRV_FIRST_ENTITY    33      // Entities below this are players
+
+typedef enum {
+    cs_free,
+    cs_connected,                       // Got "connect", waiting for "new" and "begin"
+    cs_spawned                          // In game, receiving traffic
+} fakestate_t;
+
+typedef struct {
+    fakestate_t state;
+    struct sockaddr_in adr;
+    int qport;
+    double last_recv;
+
+    // Netchan state, see netchan_transmit() and netchan_process()
+    unsigned in_seq;
+    unsigned in_acked;
+    unsigned in_rel_acked;
+    unsigned in_rel_seq;
+    unsigned out_seq;
+    unsigned rel_seq;
+    unsigned last_rel_seq;
+
+    byte message[MAX_MSG_LEN];          // Reliable data waiting to be sent
+    int message_len;
+    byte reliable[MAX_MSG_LEN];         // Reliable data sent but not acknowledged
+    int reliable_len;
+
+    int delta_seq;                      // Frame the client last asked deltas from, -1 for none
+    bool send_message;                  // Got a datagram since the last reply
+} fakeclient_t;
+
+typedef struct {
+    int port;
+    float fps;                          // Server frames per second
+    float chat_rate;                    // Chat lines per second
+    float frag_rate;                    // Frag messages per second
+    float center_rate;                  // Centerprints per second
+    int entities;                       // Moving entities per frame
+    int effects;                        // Temp entities, muzzleflashes and nails per frame
+    int loss;                           // Percentage of outgoing datagrams to drop
+    int map_time;                       // Seconds between map changes, 0 for never
+    int duration;                       // Seconds to run, 0 for forever
+} fakeopts_t;
+
+typedef struct {
+    long packets_in, packets_out, bytes_in, bytes_out;
+    long dropped;                       // Datagrams dropped on purpose
+    long retransmits;                   // Reliable messages sent again
+    long overflows;                     // Prints that didn't fit the reliable buffer
+    long chat, frags, centerprints;
+    long says;                          // say commands from the client
+    long moves, deltas;
+    long effects;
+    long signons;
+} fakestats_t;
+
+static fakeopts_t opts = {27500, 20, 2, 4, 0.5, 64, 4, 0, 0, 0};
+static fakestats_t stats, last_stats;
+static fakeclient_t client;
+static int sock;
+static int challenge;
+static int server_count;
+static volatile sig_atomic_t running = 1;
+
+static char *player_names[] = {"ParadokS", "Milton", "bps", "Locktar", "Xantom", "Rikoll", "Zero", "Nigve"};
+static char *chat_lines[] = {
+    "gg", "one more?", "lag", "quad in 20", "ra free", "nice shot", "wtf", "ready",
+    "pent soon, stack", "%s is lagging", "can we get a break after this?", "gl hf all"
+};
+static char *frag_lines[] = {
+    "%s rides %s's rocket", "%s was ax-murdered by %s", "%s eats %s's pineapple",
+    "%s accepts %s's shaft", "%s was nailed by %s", "%s chewed on %s's boomstick"
+};
+static char *center_lines[] = {
+    "Countdown: 3", "Countdown: 2", "Countdown: 1", "Spawnmodel Disabled",
+    "Match will start in 10 seconds", "Waiting for players"
+};
+static char *serverinfo = "\\maxfps\\77\\pm_ktjump\\1\\*version\\MVDSV 0.32\\*z_ext\\511\\maxclients\\8"
+    "\\timelimit\\20\\teamplay\\2\\deathmatch\\1\\map\\dm2\\status\\Standby\\ktxver\\1.38\\hostname\\fakesrv";
+
+/*
+==============
+fakesrv_time
+Returns monotonic time in seconds
+==============
+ */
+static double fakesrv_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Message writing, little-endian as on the wire
+ */
+
+static void msg_write(byte *buf, int *len, int max, void *data, int length) {
+    if (*len + length > max) {
+        *len = max + 1;                 // Mark as overflowed
+        return;
+    }
+    memcpy(buf + *len, data, length);
+    *len += length;
+}
+
+static void msg_integer(byte *buf, int *len, int max, int c, int bytes) {
+    byte b[4];
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        b[i] = (c >> (8 * i)) & 0xFF;
+    msg_write(buf, len, max, b, bytes);
+}
+
+static void msg_float(byte *buf, int *len, int max, float f) {
+    int i;
+
+    memcpy(&i, &f, sizeof (i));
+    msg_integer(buf, len, max, i, 4);
+}
+
+static void msg_string(byte *buf, int *len, int max, char *s) {
+    msg_write(buf, len, max, s, strlen(s) + 1);
+}
+
+/*
+==============
+fakesrv_reliable
+Queues a reliable message, ie. a complete svc message, for the client
+==============
+ */
+static void fakesrv_reliable(byte *data, int length) {
+    if (client.message_len + length > (int) sizeof (client.message)) {
+        stats.overflows++;
+        return;
+    }
+    memcpy(client.message + client.message_len, data, length);
+    client.message_len += length;
+}
+
+/*
+==============
+fakesrv_print
+Queues an svc_print with the given print level
+==============
+ */
+static void fakesrv_print(int level, char *text) {
+    byte buf[MAX_STRING_CHARS + 2];
+    int len = 0;
+
+    msg_integer(buf, &len, sizeof (buf), svc_print, 1);
+    msg_integer(buf, &len, sizeof (buf), level, 1);
+    msg_string(buf, &len, sizeof (buf), text);
+    if (len <= (int) sizeof (buf))
+        fakesrv_reliable(buf, len);
+}
+
+/*
+==============
+fakesrv_stufftext
+Queues a command to be executed by the client
+==============
+ */
+static void fakesrv_stufftext(char *text) {
+    byte buf[MAX_STRING_CHARS + 1];
+    int len = 0;
+
+    msg_integer(buf, &len, sizeof (buf), svc_stufftext, 1);
+    msg_string(buf, &len, sizeof (buf), text);
+    if (len <= (int) sizeof (buf))
+        fakesrv_reliable(buf, len);
+}
+
+/*
+==============
+fakesrv_oob
+Sends an out-of-band datagram
+==============
+ */
+static void fakesrv_oob(struct sockaddr_in *to, char *data) {
+    char buf[MAX_STRING_CHARS];
+    int len;
+
+    len = snprintf(buf, sizeof (buf), "\xff\xff\xff\xff%s", data);
+    sendto(sock, buf, len, 0, (struct sockaddr *) to, sizeof (*to));
+}
+
+/*
+==============
+fakesrv_transmit
+Sends a datagram to the client over the netchan, with the same reliability
+rules as the real server. Some datagrams are dropped according to opts.loss.
+==============
+ */
+static void fakesrv_transmit(byte *data, int length) {
+    byte send[MAX_MSG_LEN + QW_HEADER_LEN];
+    int len = 0;
+    bool rel_payload = false;
+
+    // The client didn't get the last reliable message, send it again
+    if (client.in_acked > client.last_rel_seq && client.in_rel_acked != client.rel_seq) {
+        rel_payload = true;
+        stats.retransmits++;
+    }
+
+    if (!client.reliable_len && client.message_len) {
+        memcpy(client.reliable, client.message, client.message_len);
+        client.reliable_len = client.message_len;
+        client.message_len = 0;
+        client.rel_seq ^= 1;
+        rel_payload = true;
+    }
+
+    msg_integer(send, &len, sizeof (send), client.out_seq | ((unsigned) rel_payload << 31), 4);
+    msg_integer(send, &len, sizeof (send), client.in_seq | (client.in_rel_seq << 31), 4);
+    client.out_seq++;
+
+    if (rel_payload) {
+        msg_write(send, &len, sizeof (send), client.reliable, client.reliable_len);
+        client.last_rel_seq = client.out_seq;
+    }
+
+    // Unreliable data only goes in if it fits, as on the real server
+    if (len + length <= MAX_MSG_LEN)
+        msg_write(send, &len, sizeof (send), data, length);
+
+    if (rand() % 100 < opts.loss) {
+        stats.dropped++;
+        return;
+    }
+
+    sendto(sock, send, len, 0, (struct sockaddr *) &client.adr, sizeof (client.adr));
+    stats.packets_out++;
+    stats.bytes_out += len;
+}
+
+/*
+==============
+fakesrv_signon
+Answers "new" with serverdata and the full serverinfo
+==============
+ */
+static void fakesrv_signon(void) {
+    byte buf[MAX_MSG_LEN];
+    char stuff[MAX_STRING_CHARS];
+    int i, len = 0;
+
+    msg_integer(buf, &len, sizeof (buf), svc_serverdata, 1);
+    msg_integer(buf, &len, sizeof (buf), QW_PROTOCOL_VERSION, 4);
+    msg_integer(buf, &len, sizeof (buf), ++server_count, 4);
+    msg_string(buf, &len, sizeof (buf), "qw");
+    // Player slot, the high bit makes us a spectator
+    msg_integer(buf, &len, sizeof (buf), 8 | 128, 1);
+    msg_string(buf, &len, sizeof (buf), "The Abandoned Base");
+    // Movevars
+    for (i = 0; i < 10; i++)
+        msg_float(buf, &len, sizeof (buf), 1.0);
+    fakesrv_reliable(buf, len);
+
+    snprintf(stuff, sizeof (stuff), "fullserverinfo \"%s\"\n", serverinfo);
+    fakesrv_stufftext(stuff);
+    stats.signons++;
+}
+
+/*
+==============
+fakesrv_stringcmd
+Acts on a string command from the client
+==============
+ */
+static void fakesrv_stringcmd(char *cmd) {
+    char text[MAX_STRING_CHARS];
+
+    if (!strcmp(cmd, "new")) {
+        client.state = cs_connected;
+        client.delta_seq = -1;
+        fakesrv_signon();
+    } else if (!strncmp(cmd, "begin", 5)) {
+        if (atoi(cmd + 5) != server_count)
+            printf("Client sent begin for server count %s, expected %d\n", cmd + 5, server_count);
+        client.state = cs_spawned;
+        printf("Client spawned\n");
+    } else if (!strncmp(cmd, "say ", 4) || !strncmp(cmd, "say_team ", 9)) {
+        // Echo back like the server would, the bot relays its own chat too
+        stats.says++;
+        snprintf(text, sizeof (text), "qwirc: %s\n", strchr(cmd, ' ') + 1);
+        fakesrv_print(PRINT_CHAT, text);
+    } else if (!strcmp(cmd, "drop")) {
+        printf("Client dropped\n");
+        client.state = cs_free;
+    }
+}
+
+/*
+==============
+fakesrv_packet
+Processes a netchan datagram from the client
+==============
+ */
+static void fakesrv_packet(byte *data, int length) {
+    unsigned seq, ack;
+    int pos, cmd;
+    char *s;
+
+    if (length < QW_HEADER_LEN + QW_QPORT_LEN)
+        return;
+
+    memcpy(&seq, data, 4);
+    memcpy(&ack, data + 4, 4);
+    seq = le32toh(seq);
+    ack = le32toh(ack);
+
+    if ((seq & ~(1u << 31)) <= client.in_seq)
+        return;
+
+    // Our reliable message got through
+    if ((ack >> 31) == client.rel_seq)
+        client.reliable_len = 0;
+
+    client.in_seq = seq & ~(1u << 31);
+    client.in_acked = ack & ~(1u << 31);
+    client.in_rel_acked = ack >> 31;
+    if (seq >> 31)
+        client.in_rel_seq ^= 1;
+    client.last_recv = fakesrv_time();
+    client.send_message = true;
+
+    pos = QW_HEADER_LEN + QW_QPORT_LEN;
+    while (pos < length) {
+        cmd = data[pos++];
+        switch (cmd) {
+            case clc_nop:
+                break;
+            case clc_stringcmd:
+                s = (char *) data + pos;
+                if (!memchr(s, 0, length - pos))
+                    return;
+                pos += strlen(s) + 1;
+                fakesrv_stringcmd(s);
+                break;
+            case clc_delta:
+                if (pos >= length)
+                    return;
+                client.delta_seq = data[pos++];
+                stats.deltas++;
+                break;
+            case clc_move:
+                // Usercmds are delta coded, nothing we need comes after them
+                stats.moves++;
+                return;
+            case clc_tmove:
+                pos += 6;
+                break;
+            default:
+                printf("Unknown client command %d\n", cmd);
+                return;
+        }
+    }
+}
+
+/*
+==============
+fakesrv_oob_packet
+Handles the connectionless part of the handshake
+==============
+ */
+static void fakesrv_oob_packet(struct sockaddr_in *from, char *data) {
+    int proto, qport, chal;
+    char reply[32];
+
+    if (!strncmp(data, "getchallenge", 12)) {
+        snprintf(reply, sizeof (reply), "%c%d", CHALLENGE_RESPONSE, challenge);
+        fakesrv_oob(from, reply);
+    } else if (sscanf(data, "connect %d %d %d", &proto, &qport, &chal) == 3) {
+        if (proto != QW_PROTOCOL_VERSION || chal != challenge) {
+            snprintf(reply, sizeof (reply), "%cBad challenge.\n", OOB_PRINT);
+            fakesrv_oob(from, reply);
+            return;
+        }
+
+        // A single client is served, a new connect replaces the old one
+        memset(&client, 0, sizeof (client));
+        client.state = cs_connected;
+        client.adr = *from;
+        client.qport = qport;
+        client.delta_seq = -1;
+        client.last_recv = fakesrv_time();
+        // Sequence 0 counts as already received, so start from 1
+        client.out_seq = 1;
+
+        snprintf(reply, sizeof (reply), "%c", CONNECTION_RESPONSE);
+        fakesrv_oob(from, reply);
+        printf("Client connected from %s:%d\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+    }
+}
+
+/*
+==============
+fakesrv_read
+Reads all waiting datagrams
+==============
+ */
+static void fakesrv_read(void) {
+    byte data[MAX_UDP_PACKET];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    int length;
+
+    for (;;) {
+        from_len = sizeof (from);
+        length = recvfrom(sock, data, sizeof (data) - 1, MSG_DONTWAIT, (struct sockaddr *) &from, &from_len);
+        if (length < 0)
+            return;
+
+        stats.packets_in++;
+        stats.bytes_in += length;
+
+        if (length >= 4 && *(int *) data == -1) {
+            data[length] = 0;
+            fakesrv_oob_packet(&from, (char *) data + 4);
+        } else if (client.state != cs_free && from.sin_addr.s_addr == client.adr.sin_addr.s_addr
+                && from.sin_port == client.adr.sin_port)
+            fakesrv_packet(data, length);
+    }
+}
+
+/*
+==============
+fakesrv_events
+Generates the scripted game events for one frame. Rates are per second, the
+fraction left over is carried to the next frame.
+==============
+ */
+static void fakesrv_events(void) {
+    static float chat_acc, frag_acc, center_acc;
+    char text[MAX_STRING_CHARS], line[MAX_STRING_CHARS / 2];
+    byte buf[MAX_STRING_CHARS];
+    int len, names = sizeof (player_names) / sizeof (player_names[0]);
+    char *killer, *victim;
+
+    chat_acc += opts.chat_rate / opts.fps;
+    frag_acc += opts.frag_rate / opts.fps;
+    center_acc += opts.center_rate / opts.fps;
+
+    for (; chat_acc >= 1; chat_acc--) {
+        // Numbered, so lost or reordered lines can be spotted on IRC
+        snprintf(line, sizeof (line), chat_lines[rand() % (sizeof (chat_lines) / sizeof (chat_lines[0]))],
+                player_names[rand() % names]);
+        snprintf(text, sizeof (text), "%s: %s #%ld\n", player_names[rand() % names], line, ++stats.chat);
+        fakesrv_print(PRINT_CHAT, text);
+    }
+
+    for (; frag_acc >= 1; frag_acc--) {
+        killer = player_names[rand() % names];
+        victim = player_names[rand() % names];
+        snprintf(line, sizeof (line), frag_lines[rand() % (sizeof (frag_lines) / sizeof (frag_lines[0]))],
+                victim, killer);
+        snprintf(text, sizeof (text), "%s\n", line);
+        fakesrv_print(PRINT_MEDIUM, text);
+        stats.frags++;
+    }
+
+    for (; center_acc >= 1; center_acc--) {
+        len = 0;
+        msg_integer(buf, &len, sizeof (buf), svc_centerprint, 1);
+        msg_string(buf, &len, sizeof (buf), center_lines[rand() % (sizeof (center_lines) / sizeof (center_lines[0]))]);
+        fakesrv_reliable(buf, len);
+        stats.centerprints++;
+    }
+}
+
+/*
+==============
+fakesrv_effects
+Writes the unreliable effects that follow the entities: temp entities of
+every type in turn, muzzleflashes and nails
+==============
+ */
+static void fakesrv_effects(byte *buf, int *len, int max) {
+    static int type;
+    int i, j, nails;
+    bool lightning;
+
+    for (i = 0; i < opts.effects; i++, stats.effects++) {
+        switch (i % 3) {
+            case 0:
+                lightning = type == te_lightning1 || type == te_lightning2 || type == te_lightning3;
+                msg_integer(buf, len, max, svc_temp_entity, 1);
+                msg_integer(buf, len, max, type, 1);
+                if (type == te_gunshot || type == te_blood)
+                    msg_integer(buf, len, max, 1 + rand() % 20, 1);
+                if (lightning)
+                    msg_integer(buf, len, max, 1 + rand() % 8, 2);
+                // Start, and for lightning the end too
+                for (j = 0; j < (lightning ? 6 : 3); j++)
+                    msg_integer(buf, len, max, rand() % 32768, 2);
+                type = (type + 1) % te_count;
+                break;
+            case 1:
+                msg_integer(buf, len, max, svc_muzzleflash, 1);
+                msg_integer(buf, len, max, 1 + rand() % 8, 2);
+                break;
+            case 2:
+                nails = 1 + rand() % 4;
+                msg_integer(buf, len, max, svc_nails, 1);
+                msg_integer(buf, len, max, nails, 1);
+                for (j = 0; j < nails * 6; j++)
+                    msg_integer(buf, len, max, rand() % 256, 1);
+                break;
+        }
+    }
+}
+
+/*
+==============
+fakesrv_frame
+Replies to the client. In the game this carries the unreliable part of a
+server frame: the time and the entities, delta compressed if the client
+asked for it. While signing on only reliable data is sent.
+==============
+ */
+static void fakesrv_frame(double now) {
+    byte buf[MAX_MSG_LEN];
+    int i, len = 0;
+    bool delta;
+
+    if (client.state == cs_spawned) {
+        msg_integer(buf, &len, sizeof (buf), svc_time, 1);
+        msg_float(buf, &len, sizeof (buf), now);
+
+        // Frames are numbered by the client packet they answer, and the
+        // client can only delta from one we still remember
+        delta = client.delta_seq >= 0 && ((client.in_seq - client.delta_seq) & 255) < UPDATE_BACKUP;
+        if (delta) {
+            msg_integer(buf, &len, sizeof (buf), svc_deltapacketentities, 1);
+            msg_integer(buf, &len, sizeof (buf), client.delta_seq, 1);
+        } else
+            msg_integer(buf, &len, sizeof (buf), svc_packetentities, 1);
+
+        // Origin changes relative to the baseline or the delta frame. With
+        // delta compression only every other entity has moved.
+        for (i = 0; i < opts.entities; i++) {
+            if (delta && (i + client.out_seq) % 2)
+                continue;
+            msg_integer(buf, &len, sizeof (buf), (FAKESRV_FIRST_ENTITY + i) | (1 << 9) | (1 << 10) | (1 << 11), 2);
+            msg_integer(buf, &len, sizeof (buf), rand() % 32768, 2);
+            msg_integer(buf, &len, sizeof (buf), rand() % 32768, 2);
+            msg_integer(buf, &len, sizeof (buf), rand() % 32768, 2);
+        }
+        msg_integer(buf, &len, sizeof (buf), 0, 2);
+
+        fakesrv_effects(buf, &len, sizeof (buf));
+    }
+
+    if (len > (int) sizeof (buf)) {
+        printf("Too many entities for one datagram, use a smaller -e\n");
+        exit(1);
+    }
+
+    fakesrv_transmit(buf, len);
+}
+
+/*
+==============
+fakesrv_report
+Prints traffic statistics for the last period
+==============
+ */
+static void fakesrv_report(double period) {
+    printf("in %.0f pkt/s %.1f kB/s, out %.0f pkt/s %.1f kB/s, chat %ld frags %ld center %ld, "
+            "says %ld, moves %.1f/s, deltas %ld, effects %ld, dropped %ld, retransmits %ld, overflows %ld\n",
+            (stats.packets_in - last_stats.packets_in) / period,
+            (stats.bytes_in - last_stats.bytes_in) / period / 1024,
+            (stats.packets_out - last_stats.packets_out) / period,
+            (stats.bytes_out - last_stats.bytes_out) / period / 1024,
+            stats.chat - last_stats.chat, stats.frags - last_stats.frags,
+            stats.centerprints - last_stats.centerprints, stats.says - last_stats.says,
+            (stats.moves - last_stats.moves) / period, stats.deltas - last_stats.deltas,
+            stats.effects - last_stats.effects,
+            stats.dropped - last_stats.dropped, stats.retransmits - last_stats.retransmits,
+            stats.overflows - last_stats.overflows);
+    fflush(stdout);
+    last_stats = stats;
+}
+
+static void fakesrv_stop(int sig) {
+    (void) sig;
+    running = 0;
+}
+
+static void fakesrv_usage(char *name) {
+    printf("Usage: %s [-p port] [-f fps] [-c chat/s] [-k frags/s] [-z centerprints/s]\n"
+            "       [-e entities] [-x effects] [-l loss %%] [-m seconds per map] [-t seconds to run]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct sockaddr_in adr;
+    struct timeval tv;
+    fd_set fds;
+    double now, start, next_frame, next_report, next_map;
+    int c;
+
+    while ((c = getopt(argc, argv, "p:f:c:k:z:e:x:l:m:t:")) != -1) {
+        switch (c) {
+            case 'p': opts.port = atoi(optarg); break;
+            case 'f': opts.fps = atof(optarg); break;
+            case 'c': opts.chat_rate = atof(optarg); break;
+            case 'k': opts.frag_rate = atof(optarg); break;
+            case 'z': opts.center_rate = atof(optarg); break;
+            case 'e': opts.entities = atoi(optarg); break;
+            case 'x': opts.effects = atoi(optarg); break;
+            case 'l': opts.loss = atoi(optarg); break;
+            case 'm': opts.map_time = atoi(optarg); break;
+            case 't': opts.duration = atoi(optarg); break;
+            default: fakesrv_usage(argv[0]);
+        }
+    }
+    if (opts.fps <= 0)
+        fakesrv_usage(argv[0]);
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&adr, 0, sizeof (adr));
+    adr.sin_family = AF_INET;
+    adr.sin_addr.s_addr = htonl(INADDR_ANY);
+    adr.sin_port = htons(opts.port);
+    if (bind(sock, (struct sockaddr *) &adr, sizeof (adr)) == -1) {
+        perror("bind");
+        return 1;
+    }
+
+    signal(SIGINT, fakesrv_stop);
+    signal(SIGTERM, fakesrv_stop);
+
+    srand(time(NULL));
+    challenge = rand();
+    printf("Fake server listening on port %d\n", opts.port);
+
+    start = next_frame = fakesrv_time();
+    next_report = start + FAKESRV_REPORT;
+    next_map = opts.map_time ? start + opts.map_time : 0;
+
+    while (running) {
+        now = fakesrv_time();
+        if (opts.duration && now - start >= opts.duration)
+            break;
+
+        if (now < next_frame) {
+            FD_ZERO(&fds);
+            FD_SET(sock, &fds);
+            tv.tv_sec = 0;
+            tv.tv_usec = (next_frame - now) * 1e6;
+            if (select(sock + 1, &fds, NULL, NULL, &tv) > 0)
+                fakesrv_read();
+            continue;
+        }
+        next_frame += 1 / opts.fps;
+
+        if (client.state != cs_free && now - client.last_recv > FAKESRV_TIMEOUT) {
+            printf("Client timed out\n");
+            client.state = cs_free;
+        }
+
+        // Like a map change on a real server, the client has to sign on again
+        if (next_map && now >= next_map) {
+            next_map = now + opts.map_time;
+            if (client.state == cs_spawned) {
+                fakesrv_stufftext("changing\n");
+                fakesrv_stufftext("reconnect\n");
+                client.state = cs_connected;
+                client.delta_seq = -1;
+            }
+        }
+
+        // The game goes on whether the client listens or not, but it only
+        // hears of it when it sends something
+        if (client.state == cs_spawned)
+            fakesrv_events();
+        if (client.state != cs_free && client.send_message) {
+            client.send_message = false;
+            fakesrv_frame(now - start);
+        }
+
+        if (now >= next_report) {
+            fakesrv_report(now - next_report + FAKESRV_REPORT);
+            next_report = now + FAKESRV_REPORT;
+        }
+    }
+
+    last_stats = (fakestats_t) {0};
+    printf("Total: ");
+    fakesrv_report(fakesrv_time() - start);
+    printf("Signons: %ld\n", stats.signons);
+    close(sock);
+    return 0;
+}
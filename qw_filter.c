@@ -0,0 +1,275 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Message filter rules and the automaton compiled from them
+ */
+
+filterrules_t filter_rules;
+
+static const char *filter_action_names[filter_count] = {"suppress", "start", "end", "route"};
+
+static struct {
+    automaton_t automaton;                  // Case folded
+    uint32_t *match;                        // Rules matched on entering a state
+    uint32_t actions[filter_count];         // Rules with each action
+    uint32_t classes[relay_count];          // Rules that apply to each class
+    int rule_classes[MAX_FILTER_RULES];
+    relayclass_t route[MAX_FILTER_RULES];
+    int blocked;                            // Classes held back by a start rule
+} filter;
+
+/*
+==============
+filter_defaults
+Hides the statistics KTX prints at the end of a match. Call with
+qw_mutex held.
+==============
+ */
+void filter_defaults(void) {
+    filter_clear();
+    filter_add("start", "normal,chat", "Player statistics", NULL);
+    filter_add("end", "normal,chat", "top scorers", NULL);
+}
+
+/*
+==============
+filter_clear
+Removes all rules. Call with qw_mutex held.
+==============
+ */
+void filter_clear(void) {
+    filter_rules.count = 0;
+    filter_rules.changed = true;
+}
+
+/*
+==============
+filter_class
+Returns the relay class with the given name, or -1
+==============
+ */
+static int filter_class(char *name) {
+    int i;
+
+    for (i = 0; i < relay_count; i++) {
+        if (!strcasecmp(name, relay_class_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/*
+==============
+filter_add
+Adds a rule. "classes" is a comma separated list of relay classes or
+"all", "route" the class filter_route rules send lines to. Returns NULL, or
+what was wrong with the rule. Call with qw_mutex held.
+==============
+ */
+char *filter_add(char *action, char *classes, char *pattern, char *route) {
+    filterrule_t rule = {0};
+    char list[64], *name, *save;
+    int class;
+
+    for (rule.action = 0; rule.action < filter_count; rule.action++) {
+        if (!strcasecmp(action, filter_action_names[rule.action]))
+            break;
+    }
+    if (rule.action == filter_count)
+        return "unknown action, use suppress, start, end or route";
+
+    if (!strcasecmp(classes, "all"))
+        rule.classes = (1 << relay_count) - 1;
+    else {
+        strncpy(list, classes, sizeof (list) - 1);
+        list[sizeof (list) - 1] = 0;
+        for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            if ((class = filter_class(name)) < 0)
+                return "unknown class, use status, normal, centerprint, chat or all";
+            rule.classes |= 1 << class;
+        }
+        if (!rule.classes)
+            return "no classes given";
+    }
+
+    if (!pattern[0] || strlen(pattern) >= MAX_FILTER_PATTERN)
+        return "pattern must be 1-63 characters";
+
+    if (rule.action == filter_route) {
+        if (!route || (class = filter_class(route)) < 0)
+            return "route needs the class to send lines to";
+        rule.route = class;
+    } else if (route)
+        return "only route takes a class to send lines to";
+
+    if (filter_rules.count == MAX_FILTER_RULES)
+        return "too many rules";
+
+    strcpy(rule.pattern, pattern);
+    filter_rules.rule[filter_rules.count++] = rule;
+    filter_rules.changed = true;
+    return NULL;
+}
+
+/*
+==============
+filter_describe
+Writes out a rule the way qwfilter add takes it. Call with qw_mutex held.
+==============
+ */
+void filter_describe(int index, char *line, int size) {
+    filterrule_t *rule = &filter_rules.rule[index];
+    char classes[64] = "";
+    int i;
+
+    for (i = 0; i < relay_count; i++) {
+        if (!(rule->classes & (1 << i)))
+            continue;
+        if (classes[0])
+            strncat(classes, ",", sizeof (classes) - strlen(classes) - 1);
+        strncat(classes, relay_class_names[i], sizeof (classes) - strlen(classes) - 1);
+    }
+
+    if (rule->classes == (1 << relay_count) - 1)
+        strcpy(classes, "all");
+
+    snprintf(line, size, "%s %s {%s}%s%s", filter_action_names[rule->action], classes, rule->pattern,
+            rule->action == filter_route ? " " : "", rule->action == filter_route ? relay_class_names[rule->route] : "");
+}
+
+/*
+==============
+filter_compile
+Builds the automaton, and the rules matched on entering each state: those
+whose pattern ends in the state or anywhere down its failure chain
+==============
+ */
+static void filter_compile(void) {
+    filterrule_t *rule;
+    char *patterns[MAX_FILTER_RULES];
+    uint32_t same[MAX_FILTER_RULES];        // Rules with the same pattern as each rule
+    automaton_t *a = &filter.automaton;
+    int s, t, c, r, i;
+
+    automaton_free(a);
+    qw_free(filter.match);
+    memset(&filter, 0, sizeof (filter));
+    if (!filter_rules.count)
+        return;
+
+    for (r = 0; r < filter_rules.count; r++) {
+        rule = &filter_rules.rule[r];
+        patterns[r] = rule->pattern;
+        filter.actions[rule->action] |= 1u << r;
+        for (c = 0; c < relay_count; c++) {
+            if (rule->classes & (1 << c))
+                filter.classes[c] |= 1u << r;
+        }
+        filter.rule_classes[r] = rule->classes;
+        filter.route[r] = rule->route;
+        same[r] = 0;
+        for (i = 0; i < filter_rules.count; i++) {
+            if (!strcasecmp(rule->pattern, filter_rules.rule[i].pattern))
+                same[r] |= 1u << i;
+        }
+    }
+
+    if (!automaton_build(a, patterns, filter_rules.count, true, mem_filter))
+        return;
+    if (!(filter.match = qw_malloc(mem_filter, a->states * sizeof (uint32_t)))) {
+        printf("Error: Out of memory. (filter_compile())\n");
+        automaton_free(a);
+        memset(&filter, 0, sizeof (filter));
+        return;
+    }
+    for (s = 0; s < a->states; s++) {
+        filter.match[s] = 0;
+        for (t = a->pattern[s] >= 0 ? s : a->output[s]; t; t = a->output[t])
+            filter.match[s] |= same[a->pattern[t]];
+    }
+}
+
+/*
+==============
+filter_update
+Compiles the rules if they changed. Call with qw_mutex held from the
+thread that relays text.
+==============
+ */
+void filter_update(void) {
+    if (!filter_rules.changed)
+        return;
+    filter_compile();
+    filter_rules.changed = false;
+}
+
+/*
+==============
+filter_reset
+Ends a block of lines started by a start rule, e.g. when the map changes
+before the end rule matched
+==============
+ */
+void filter_reset(void) {
+    filter.blocked = 0;
+}
+
+/*
+==============
+filter_line
+Runs a line through the rules. Returns false if the line isn't to be
+relayed. A route rule changes "class".
+==============
+ */
+bool filter_line(char *line, relayclass_t *class) {
+    uint32_t hits = 0, routed;
+    int state = 0, r;
+    char *c;
+
+    if (!filter.match)
+        return true;
+
+    for (c = line; *c; c++) {
+        state = AUTOMATON_NEXT(&filter.automaton, state, *c);
+        hits |= filter.match[state];
+    }
+    hits &= filter.classes[*class];
+
+    if (filter.blocked & (1 << *class)) {
+        if (!(hits & filter.actions[filter_end]))
+            return false;
+        filter.blocked = 0;
+    } else if (hits & filter.actions[filter_start]) {
+        for (r = 0; r < MAX_FILTER_RULES; r++) {
+            if (hits & filter.actions[filter_start] & (1u << r))
+                filter.blocked |= filter.rule_classes[r];
+        }
+        return false;
+    }
+
+    if (hits & filter.actions[filter_suppress])
+        return false;
+    if ((routed = hits & filter.actions[filter_route]))
+        *class = filter.route[__builtin_ctz(routed)];
+    return true;
+}
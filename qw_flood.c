@@ -0,0 +1,196 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Chat lines from players saying too much too fast are held back
+ */
+
+flood_t flood;
+
+/*
+==============
+flood_reset
+Starts counting every player's lines afresh
+==============
+ */
+static void flood_reset(void) {
+    int i, j;
+
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        for (j = 0; j < MAX_FLOOD_LINES; j++)
+            flood.times[i][j] = -1e9;
+        flood.next[i] = flood.held[i] = 0;
+    }
+}
+
+/*
+==============
+flood_clear
+Forgets the players and settings of the previous session
+==============
+ */
+void flood_clear(void) {
+    memset(&flood, 0, sizeof (flood));
+    flood.name_serial = -1;
+    flood_reset();
+}
+
+/*
+==============
+flood_build
+Builds the trie of the names on the scoreboard. Children are kept in a
+list of siblings, as names have few branches.
+==============
+ */
+static void flood_build(void) {
+    trienode_t *node;
+    int slot, n, c;
+    char *p;
+
+    memset(&flood.trie[0], 0, sizeof (flood.trie[0]));
+    flood.trie[0].slot = -1;
+    flood.nodes = 1;
+    for (slot = 0; slot < MAX_CLIENTS; slot++) {
+        if (!scoreboard.active[slot] || !scoreboard.clean_name[slot][0])
+            continue;
+        for (n = 0, p = scoreboard.clean_name[slot]; *p; p++, n = c) {
+            for (c = flood.trie[n].child; c && flood.trie[c].c != (byte) *p; c = flood.trie[c].sibling);
+            if (!c) {
+                c = flood.nodes++;
+                node = &flood.trie[c];
+                node->c = *p;
+                node->slot = -1;
+                node->child = 0;
+                node->sibling = flood.trie[n].child;
+                flood.trie[n].child = c;
+            }
+        }
+        // Of players with the same name, the first one gets the lines
+        if (flood.trie[n].slot < 0)
+            flood.trie[n].slot = slot;
+    }
+    flood.name_serial = scoreboard.name_serial;
+}
+
+/*
+==============
+flood_slot
+Returns the slot of the player who said a chat line, or -1. Lines start
+with "name: ", or "(name): " when said to the team. Names may begin with
+another player's name, so the longest one wins.
+==============
+ */
+static int flood_slot(char *line) {
+    bool team = *line == '(';
+    int n = 0, slot = -1;
+    char *p;
+
+    for (p = line + team; *p; p++) {
+        for (n = flood.trie[n].child; n && flood.trie[n].c != (byte) *p; n = flood.trie[n].sibling);
+        if (!n)
+            break;
+        if (flood.trie[n].slot >= 0 && (team ? p[1] == ')' && p[2] == ':' : p[1] == ':'))
+            slot = flood.trie[n].slot;
+    }
+    return slot;
+}
+
+/*
+==============
+flood_line
+Counts a line of chat against the player who said it. Returns false if
+the line is to be held back.
+==============
+ */
+bool flood_line(char *line) {
+    float *oldest;
+    bool allowed;
+    int slot;
+
+    if (!flood.lines)
+        return true;
+    if (flood.name_serial != scoreboard.name_serial)
+        flood_build();
+    if ((slot = flood_slot(line)) < 0)
+        return true;
+
+    // Held back lines count too, so a player has to slow down to be heard
+    oldest = &flood.times[slot][flood.next[slot]];
+    allowed = qw.realtime - *oldest >= flood.window;
+    *oldest = qw.realtime;
+    flood.next[slot] = (flood.next[slot] + 1) % flood.lines;
+    if (allowed)
+        return true;
+
+    if (!flood.held[slot]++)
+        strcpy(flood.name[slot], scoreboard.clean_name[slot]);
+    metric_add(metric_flooded, 1);
+    return false;
+}
+
+/*
+==============
+flood_notice
+Tells how many lines of a player were held back
+==============
+ */
+static void flood_notice(int slot) {
+    char line[64 + MAX_SCOREBOARDNAME];
+
+    snprintf(line, sizeof (line), "(%d line%s suppressed from %s)\n", flood.held[slot],
+            flood.held[slot] == 1 ? "" : "s", flood.name[slot]);
+    flood.held[slot] = 0;
+    qw_to_irc_print(line, color_statusmessage);
+}
+
+/*
+==============
+flood_frame
+Sends the notice for players who have slowed down enough to be heard
+again, called every frame
+==============
+ */
+void flood_frame(void) {
+    int slot;
+
+    for (slot = 0; slot < MAX_CLIENTS; slot++) {
+        if (flood.held[slot] && qw.realtime - flood.times[slot][flood.next[slot]] >= flood.window)
+            flood_notice(slot);
+    }
+}
+
+/*
+==============
+flood_flush
+Sends the notices still due and starts counting afresh, e.g. when the
+settings may change with a new map
+==============
+ */
+void flood_flush(void) {
+    int slot;
+
+    for (slot = 0; slot < MAX_CLIENTS; slot++) {
+        if (flood.held[slot])
+            flood_notice(slot);
+    }
+    flood_reset();
+}
@@ -0,0 +1,365 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Obituaries loaded from a fragfile, and the kill events they turn into
+ */
+
+fraglog_t frag_log;
+fraglog_t frag_log_shared;
+
+const char *kill_kind_names[kill_count] = {"frag", "teamkill", "suicide", "death"};
+
+static const char *obituary_type_names[obit_count] = {
+    "PLAYER_DEATH", "PLAYER_SUICIDE", "X_FRAGS_UNKNOWN", "X_TEAMKILLS_UNKNOWN",
+    "X_TEAMKILLED_UNKNOWN", "X_FRAGGED_BY_Y", "X_FRAGS_Y", "X_TEAMKILLED_BY_Y", "X_TEAMKILLS_Y"
+};
+
+typedef struct {
+    obituarytype_t type;
+    int weapon;                             // Weapon class
+    char msg2[MAX_OBITUARY_MSG];            // Text after Y, may be empty
+    int msg2_len;
+    int next;                               // Next obituary with the same text after X, or -1
+} obituary_t;
+
+// Everything loaded from a fragfile, from the heap so that it's accounted for
+typedef struct {
+    automaton_t automaton;                  // Over msg1
+    char msg1[MAX_OBITUARIES][MAX_OBITUARY_MSG]; // Texts after X, each once
+    int msg1_len[MAX_OBITUARIES];
+    int first[MAX_OBITUARIES];              // First obituary with each msg1
+    int patterns;
+    obituary_t obituary[MAX_OBITUARIES];    // In fragfile order, which is also the order of preference
+    int count;
+    char weapon[MAX_WEAPON_CLASSES][MAX_WEAPON_NAME]; // Short names
+} fragfile_t;
+
+static fragfile_t *fragfile;
+
+/*
+==============
+frags_add
+Adds an obituary. Returns NULL, or what was wrong with it.
+==============
+ */
+static char *frags_add(obituarytype_t type, int weapon, char *msg1, char *msg2) {
+    obituary_t *obit;
+    int i, *link;
+
+    if (!msg1[0] || strlen(msg1) >= MAX_OBITUARY_MSG || strlen(msg2) >= MAX_OBITUARY_MSG)
+        return "message must be 1-63 characters";
+    if (fragfile->count == MAX_OBITUARIES)
+        return "too many obituaries";
+
+    for (i = 0; i < fragfile->patterns && strcmp(fragfile->msg1[i], msg1); i++);
+    if (i == fragfile->patterns) {
+        strcpy(fragfile->msg1[i], msg1);
+        fragfile->msg1_len[i] = strlen(msg1);
+        fragfile->first[i] = -1;
+        fragfile->patterns++;
+    }
+
+    // Obituaries with the same msg1 stay in fragfile order
+    for (link = &fragfile->first[i]; *link >= 0; link = &fragfile->obituary[*link].next);
+    *link = fragfile->count;
+
+    obit = &fragfile->obituary[fragfile->count++];
+    obit->type = type;
+    obit->weapon = weapon;
+    strcpy(obit->msg2, msg2);
+    obit->msg2_len = strlen(msg2);
+    obit->next = -1;
+    return NULL;
+}
+
+/*
+==============
+frags_define
+Handles a tokenized #DEFINE line. Returns NULL, or what was wrong with it.
+==============
+ */
+static char *frags_define(void) {
+    char *kind = parser_argv(1);
+    int number, type;
+
+    if (!strcasecmp(kind, "WEAPON_CLASS") || !strcasecmp(kind, "WC")) {
+        if (parser_argc() < 4)
+            return "weapon class needs a number and a name";
+        number = atoi(parser_argv(2));
+        if (number < 1 || number >= MAX_WEAPON_CLASSES)
+            return "weapon class number out of range";
+        // The short name, if there is one
+        strncpy(fragfile->weapon[number], parser_argv(parser_argc() > 4 ? 4 : 3), MAX_WEAPON_NAME - 1);
+        return NULL;
+    }
+
+    // Flag alerts and anything newer aren't needed
+    if (strcasecmp(kind, "OBITUARY") && strcasecmp(kind, "OBIT"))
+        return NULL;
+
+    if (parser_argc() < 5)
+        return "obituary needs a type, a weapon class and a message";
+    for (type = 0; type < obit_count && strcasecmp(parser_argv(2), obituary_type_names[type]); type++);
+    if (type == obit_count)
+        return "unknown obituary type";
+    number = atoi(parser_argv(3));
+    if (number < 0 || number >= MAX_WEAPON_CLASSES)
+        return "weapon class number out of range";
+    return frags_add(type, number, parser_argv(4), parser_argc() > 5 ? parser_argv(5) : "");
+}
+
+/*
+==============
+frags_load
+Loads and compiles a fragfile, replacing the one loaded before. An empty
+path turns obituary parsing off. Returns false on error.
+==============
+ */
+bool frags_load(char *path) {
+    char line[MAX_STRING_CHARS], *error, *patterns[MAX_OBITUARIES];
+    bool header = false;
+    int number = 0, i;
+    FILE *f;
+
+    if (fragfile) {
+        automaton_free(&fragfile->automaton);
+        qw_free(fragfile);
+        fragfile = NULL;
+    }
+    if (!path[0])
+        return true;
+
+    if (!(f = fopen(path, "r"))) {
+        printf("Error: Can't open fragfile %s: %s. (frags_load())\n", path, strerror(errno));
+        return false;
+    }
+    if (!(fragfile = qw_malloc(mem_frags, sizeof (*fragfile)))) {
+        printf("Error: Out of memory. (frags_load())\n");
+        fclose(f);
+        return false;
+    }
+    memset(fragfile, 0, sizeof (*fragfile));
+
+    while (fgets(line, sizeof (line), f)) {
+        number++;
+        parser_tokenize(line, false);
+        if (!parser_argc())
+            continue;
+        if (!strcasecmp(parser_argv(0), "#FRAGFILE")) {
+            header = true;
+            continue;
+        }
+        if (!header)
+            break;
+        // Anything else, like #META, is only of interest to clients
+        if (strcasecmp(parser_argv(0), "#DEFINE") || parser_argc() < 2)
+            continue;
+        if ((error = frags_define()))
+            printf("Error: %s line %d: %s. (frags_load())\n", path, number, error);
+    }
+    fclose(f);
+
+    if (!header) {
+        printf("Error: %s is not a fragfile. (frags_load())\n", path);
+        qw_free(fragfile);
+        fragfile = NULL;
+        return false;
+    }
+
+    for (i = 0; i < fragfile->patterns; i++)
+        patterns[i] = fragfile->msg1[i];
+    if (!automaton_build(&fragfile->automaton, patterns, fragfile->patterns, false, mem_frags)) {
+        qw_free(fragfile);
+        fragfile = NULL;
+        return false;
+    }
+    return true;
+}
+
+/*
+==============
+frags_clear
+Forgets the kill events of the previous session
+==============
+ */
+void frags_clear(void) {
+    memset(&frag_log, 0, sizeof (frag_log));
+    frag_log.changed = true;
+}
+
+/*
+==============
+frags_slot
+Returns the slot of the player with a name, or -1 if nobody in the game
+has it
+==============
+ */
+static int frags_slot(char *name, int len) {
+    int i;
+
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        if (scoreboard.active[i] && !strncmp(scoreboard.clean_name[i], name, len)
+                && !scoreboard.clean_name[i][len])
+            return i;
+    }
+    return -1;
+}
+
+/*
+==============
+frags_copy_name
+Copies a name out of a line
+==============
+ */
+static void frags_copy_name(char *name, char *text, int len) {
+    len = MIN(len, MAX_SCOREBOARDNAME - 1);
+    memcpy(name, text, len);
+    name[len] = 0;
+}
+
+/*
+==============
+frags_event
+Logs the kill event an obituary tells of. X and Y are the names in the
+line, in the order they appear.
+==============
+ */
+static void frags_event(obituary_t *obit, char *x, int x_len, char *y, int y_len) {
+    killevent_t *event = &frag_log.event[frag_log.count++ % FRAG_LOG_SIZE];
+    char *killer = NULL, *victim = NULL;
+    int killer_len = 0, victim_len = 0;
+
+    switch (obit->type) {
+        case obit_death:
+            event->kind = kill_death;
+            victim = x, victim_len = x_len;
+            break;
+        case obit_suicide:
+            event->kind = kill_suicide;
+            killer = victim = x, killer_len = victim_len = x_len;
+            break;
+        case obit_frags_unknown:
+        case obit_teamkills_unknown:
+            event->kind = obit->type == obit_frags_unknown ? kill_frag : kill_teamkill;
+            killer = x, killer_len = x_len;
+            break;
+        case obit_teamkilled_unknown:
+            event->kind = kill_teamkill;
+            victim = x, victim_len = x_len;
+            break;
+        case obit_fragged_by:
+        case obit_teamkilled_by:
+            event->kind = obit->type == obit_fragged_by ? kill_frag : kill_teamkill;
+            victim = x, victim_len = x_len;
+            killer = y, killer_len = y_len;
+            break;
+        default:
+            event->kind = obit->type == obit_frags ? kill_frag : kill_teamkill;
+            killer = x, killer_len = x_len;
+            victim = y, victim_len = y_len;
+            break;
+    }
+
+    frags_copy_name(event->killer, killer ? killer : "", killer_len);
+    frags_copy_name(event->victim, victim ? victim : "", victim_len);
+    event->killer_slot = killer ? frags_slot(killer, killer_len) : -1;
+    event->victim_slot = victim ? frags_slot(victim, victim_len) : -1;
+    strcpy(event->weapon, fragfile->weapon[obit->weapon]);
+    event->time = qw.realtime;
+    frag_log.changed = true;
+    metric_add(metric_kills + event->kind, 1);
+    summary_kill(event);
+}
+
+/*
+==============
+frags_line
+Runs a line of text through the obituaries in one pass. Every place where
+a msg1 ends is a candidate: X is what comes before it, and the rest of the
+line must be empty, or Y and msg2 for obituaries that name two players.
+Candidates naming players in the game win, otherwise the one first in the
+fragfile does. Returns true if the line was an obituary.
+==============
+ */
+bool frags_line(char *line) {
+    automaton_t *a;
+    obituary_t *obit, *best = NULL;
+    int len, state = 0, i, t, n, x_len, rest, y_len, best_x = 0, best_y = 0, best_y_len = 0;
+    bool known, best_known = false;
+
+    if (!fragfile)
+        return false;
+
+    a = &fragfile->automaton;
+    len = strcspn(line, "\n");
+    for (i = 0; i < len; i++) {
+        state = AUTOMATON_NEXT(a, state, line[i]);
+        for (t = a->pattern[state] >= 0 ? state : a->output[state]; t; t = a->output[t]) {
+            x_len = i + 1 - fragfile->msg1_len[a->pattern[t]];
+            rest = len - i - 1;
+            if (!x_len)
+                continue;
+
+            for (n = fragfile->first[a->pattern[t]]; n >= 0; n = obit->next) {
+                obit = &fragfile->obituary[n];
+                if (obit->type >= obit_fragged_by) {
+                    y_len = rest - obit->msg2_len;
+                    if (y_len <= 0 || memcmp(line + len - obit->msg2_len, obit->msg2, obit->msg2_len))
+                        continue;
+                } else if (rest)
+                    continue;
+                else
+                    y_len = 0;
+
+                known = frags_slot(line, x_len) >= 0 && (!y_len || frags_slot(line + i + 1, y_len) >= 0);
+                if (best && (best_known > known || (best_known == known && best < obit)))
+                    continue;
+                best = obit;
+                best_known = known;
+                best_x = x_len;
+                best_y = i + 1;
+                best_y_len = y_len;
+            }
+        }
+    }
+
+    if (!best)
+        return false;
+    frags_event(best, line, best_x, line + best_y, best_y_len);
+    return true;
+}
+
+/*
+==============
+frags_publish
+Copies the kill events for the IRC side if there are new ones. Call with
+qw_mutex held.
+==============
+ */
+void frags_publish(void) {
+    if (!frag_log.changed)
+        return;
+
+    frag_log.changed = false;
+    memcpy(&frag_log_shared, &frag_log, sizeof (frag_log));
+}
@@ -0,0 +1,241 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+#include <sys/stat.h>
+
+/*
+ * Fuzzing entry points for the decoders of server input.
+ *
+ * The first byte of an input selects the decoder and the rest is passed to
+ * it: a connection-oriented datagram (header included) for
+ * net_parse_command, an out-of-band datagram for net_oob_process, or
+ * command text for exec_stufftext.
+ *
+ * Built for libFuzzer ("make fuzz") the fuzzer provides main() and reports
+ * coverage and exec/s. Otherwise main() runs the files given as arguments,
+ * or stdin for AFL, and reports exec/s. "qwfuzz -s <capture> <dir>" turns
+ * a capture recorded with qw_capture_file into seed inputs.
+ */
+
+typedef enum {
+    fuzz_parse,
+    fuzz_oob,
+    fuzz_stufftext,
+    fuzz_count
+} fuzztarget_t;
+
+static bool fuzz_initialized;
+
+/*
+==============
+fuzz_init
+Sets up the module state once. Nothing is sent while capture_replaying
+is set, and IRC output is discarded.
+==============
+ */
+static void fuzz_init(void) {
+    net_message.data = net_message_buffer;
+    net_message.max_size = sizeof (net_message_buffer);
+    qw_cleantext_init();
+    infostring_init();
+    filter_defaults();
+    filter_update();
+    capture_replaying = true;
+
+    // A numeric address, so that reconnects don't wait for DNS
+    strcpy(qw_server, "127.0.0.1");
+
+    // Summaries start with the next serverdata
+    qw_summary_window = 30;
+
+    // Obituaries are only parsed with a fragfile, serverdata reloads it
+    if (getenv("QW_FUZZ_FRAGFILE")) {
+        strncpy(qw_fragfile, getenv("QW_FUZZ_FRAGFILE"), sizeof (qw_fragfile) - 1);
+        frags_load(qw_fragfile);
+    }
+
+    // The decoders are chatty about bad input
+    if (!getenv("QW_FUZZ_VERBOSE"))
+        freopen("/dev/null", "w", stdout);
+
+    fuzz_initialized = true;
+}
+
+/*
+==============
+fuzz_reset
+Puts the session back to a connected, active state between inputs
+==============
+ */
+static void fuzz_reset(void) {
+    netadr_t adr;
+
+    memset(&adr, 0, sizeof (adr));
+    adr.ip.as_int = htonl(INADDR_LOOPBACK);
+    adr.port = htons(27500);
+
+    netchan_setup(&netchan, adr, 0);
+    net_from = adr;
+    con_state = active;
+    qw_running = true;
+    qw.valid_sequence = 0;
+
+    infostring_clear(userinfo_root, false);
+    infostring_clear(serverinfo_root, false);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char text[MAX_STRING_CHARS];
+    int pri;
+
+    if (!fuzz_initialized)
+        fuzz_init();
+    if (size < 1 || size - 1 > MAX_UDP_PACKET)
+        return 0;
+
+    fuzz_reset();
+
+    net_message.cur_size = size - 1;
+    memcpy(net_message.data, data + 1, size - 1);
+
+    switch (data[0] % fuzz_count) {
+        case fuzz_parse:
+            // Same steps as in qw_frame()
+            if (net_message.cur_size < 8 || !netchan_process(&netchan))
+                break;
+            net_parse_command();
+            break;
+
+        case fuzz_oob:
+            con_state = disconnected;
+            net_oob_process();
+            break;
+
+        case fuzz_stufftext:
+            // As it would come from net_read_string()
+            size = MIN(size - 1, sizeof (text) - 1);
+            memcpy(text, data + 1, size);
+            text[size] = 0;
+            exec_stufftext(text);
+            break;
+    }
+
+    // Replies are never sent, don't let them pile up
+    buf_clear(&netchan.message);
+    buf_clear(&netchan.datagram);
+    for (pri = 0; pri < pri_count; pri++)
+        buf_clear(&netchan.cmd_queue[pri]);
+    netchan.say_count = netchan.say_packed = 0;
+
+    return 0;
+}
+
+#ifndef QW_LIBFUZZER
+
+/*
+==============
+fuzz_seed
+Writes each datagram of a capture file as a seed input
+==============
+ */
+static int fuzz_seed(char *path, char *dir) {
+    FILE *in, *out;
+    char magic[sizeof (CAPTURE_MAGIC)], name[MAX_OSPATH];
+    byte data[MAX_UDP_PACKET];
+    capture_rec_t rec;
+    int count = 0;
+
+    if (!(in = fopen(path, "rb"))) {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (fread(magic, 1, sizeof (magic), in) != sizeof (magic) || memcmp(magic, CAPTURE_MAGIC, sizeof (magic))) {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        fclose(in);
+        return 1;
+    }
+    mkdir(dir, 0755);
+
+    while (fread(&rec, sizeof (rec), 1, in) == 1) {
+        if (rec.length > MAX_UDP_PACKET || fread(data, 1, rec.length, in) != rec.length)
+            break;
+
+        snprintf(name, sizeof (name), "%s/capture-%05d", dir, count++);
+        if (!(out = fopen(name, "wb"))) {
+            fprintf(stderr, "Can't write %s: %s\n", name, strerror(errno));
+            break;
+        }
+        fputc(rec.length >= 4 && *(int *) data == -1 ? fuzz_oob : fuzz_parse, out);
+        fwrite(data, 1, rec.length, out);
+        fclose(out);
+    }
+
+    fclose(in);
+    fprintf(stderr, "Wrote %d seeds to %s\n", count, dir);
+    return 0;
+}
+
+/*
+==============
+fuzz_run
+Runs one input read from a file
+==============
+ */
+static void fuzz_run(FILE *in) {
+    static byte data[MAX_UDP_PACKET + 1];
+    size_t size;
+
+    size = fread(data, 1, sizeof (data), in);
+    LLVMFuzzerTestOneInput(data, size);
+}
+
+int main(int argc, char **argv) {
+    struct timespec start, end;
+    FILE *in;
+    double elapsed;
+    int i, runs = 0;
+
+    if (argc == 4 && !strcmp(argv[1], "-s"))
+        return fuzz_seed(argv[2], argv[3]);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (argc < 2) {
+        fuzz_run(stdin);
+        runs++;
+    }
+    for (i = 1; i < argc; i++) {
+        if (!(in = fopen(argv[i], "rb"))) {
+            fprintf(stderr, "Can't open %s: %s\n", argv[i], strerror(errno));
+            continue;
+        }
+        fuzz_run(in);
+        fclose(in);
+        runs++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d inputs in %.3f s, %.0f exec/s\n", runs, elapsed, runs / MAX(elapsed, 1e-9));
+    return 0;
+}
+
+#endif
@@ -19,6 +19,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qw_common.h"
 
+bool qw_running;                        // Is the QuakeWorld thread running?
+bool print_ver_info;                    // Print version info on connecting?
+float res_last_calc;                    // When last resource usage calculation was done
+struct rusage qw_rusage;                // QuakeWorld thread resource usage
+
 /*
 ==============
 qw_init
@@ -27,15 +32,22 @@ Starts the QWCL loop
  */
 void *qw_init(void *arg) {
     // Set up QuakeWorld UDP connection
-    pthread_mutex_lock(&qw_mutex);
+    qw_mutex_lock();
+    prof_start();
+    metrics_thread_start();
+    flight_thread_start();
+    filter_update();
+    scrollback_clear();
     con_init(qw_server_port);
+    if (qw_capture_file[0])
+        capture_open(qw_capture_file);
     pthread_mutex_unlock(&qw_mutex);
 
-    // Set up QuakeWorld player infostring
-    infostring_init();
-
-    // Start connecting to the server
-    qw.connect_time = -999;
+    // Start connecting to the server. Userinfo was just rebuilt.
+    qw_session_clear();
+    qw.userinfo[0] = 0;
+    qw.reconnect_start = 0;
+    qw.timeout_reconnect = 0;
     net_request_challenge();
 
     // This will force resource usage calculation on next qw_frame() iteration
@@ -50,6 +62,39 @@ void *qw_init(void *arg) {
     return 0;
 }
 
+/*
+==============
+qw_session_clear
+Forgets what the previous session learned about the server and its
+players, and sets up the player infostring. What is kept across reconnects
+is left alone.
+==============
+ */
+void qw_session_clear(void) {
+    infostring_init();
+    scoreboard_clear();
+    entities_clear();
+    latency_clear();
+    frags_clear();
+    summary_clear();
+    dedupe_clear();
+    flood_clear();
+
+    qw.challenge = 0;
+    qw.user_id = 0;
+    qw.server_id = 0;
+    qw.game = NULL;
+    qw.player_num = 0;
+    qw.map[0] = 0;
+    qw.serverinfo[0] = 0;
+    qw.connect_time = -999;
+    qw.valid_sequence = 0;
+    netchan.last_move = 0;
+    // Until serverdata reads the settings, nothing is left out
+    qw.print_filter = 0;
+    qw.frag_relay = true;
+}
+
 /*
 ==============
 qw_frame
@@ -57,14 +102,23 @@ Main QuakeWorld loop, executed QW_FPS times per second
 ==============
  */
 void qw_frame() {
-    netbuf_t buf;
-    usleep((1.0f / QW_FPS) * 1000 * 1000);
-
-    // Keep the connection live. we won't get data unless we also send some..
-    if (con_state == active)
-        netchan_keepalive();
-
+    // While signing on, wake up as soon as the server replies so that each
+    // signon step doesn't wait for a whole frame
+    prof_enter(prof_idle);
+    if (con_state != active)
+        udp_wait(1000 / QW_FPS);
+    else
+        usleep((1.0f / QW_FPS) * 1000 * 1000);
+    prof_enter(prof_other);
+    get_time();
+
+    // Nothing allocated from the arena outlives a frame
+    arena_release(0);
+
+    // udp_process() enters the receive phase itself
     while (udp_process()) {
+        prof_enter(prof_netchan);
+
         // Out-of-band message
         if (*(int *) net_message.data == -1) {
             net_oob_process();
@@ -79,53 +133,88 @@ void qw_frame() {
         if (!netchan_process(&netchan))
             continue; // Rejected packet
 
+        prof_enter(prof_parse);
         net_parse_command();
         buf_clear(&net_message);
     }
-
-    // Check for reliable retransmit
-    if (con_state <= connected || netchan.message.cur_size) {
-        if (netchan.message.cur_size || qw.realtime - netchan.last_sent.time > 1000) {
-            byte data[128];
-            buf_init(&buf, data, sizeof (data));
-            netchan_transmit(&netchan, buf.cur_size, buf.data);
-            buf_clear(&netchan.message);
+    // Anything printed from here on wasn't caused by a received datagram
+    net_recv_stamp = 0;
+    prof_enter(prof_transmit);
+
+    // Pack queued commands and keepalive data into a single datagram. Also
+    // check for reliable retransmit.
+    if (con_state >= connected) {
+        // Keep the connection live. we won't get data unless we also send some..
+        if (con_state == active && netchan_keepalive_due(&netchan))
+            netchan_keepalive();
+        netchan_pack(&netchan);
+        if (netchan.message.cur_size || netchan.datagram.cur_size
+                || (con_state != active && qw.realtime - netchan.last_sent.time > 1000)) {
+            netchan_transmit(&netchan, netchan.datagram.cur_size, netchan.datagram.data);
+            buf_clear(&netchan.datagram);
         }
     }
+    prof_enter(prof_other);
 
     // Get a new challenge if needed
     if (con_state == disconnected)
         net_request_challenge();
 
-    // Timeout after 30 seconds of silence
-    if (qw.realtime - netchan.last_recv.time > 30000 && con_state >= connected) {
-        qw_to_irc_print("Connection timed out. Exiting thread.\n", color_statusmessage);
-        pthread_mutex_lock(&qw_mutex);
+    // Timeout after 30 seconds of silence. Try to reconnect once, and give up
+    // if the server stays silent after that too. Map changes and slow
+    // signons don't count as long as the server keeps sending.
+    if (qw.timeout_reconnect
+            && qw.realtime - MAX(qw.timeout_reconnect, netchan.last_recv.time) > CONNECT_TIMEOUT) {
+        qw_to_irc_print("Reconnect timed out. Exiting thread.\n", color_statusmessage);
+        qw_mutex_lock();
         qw_running = false;
         pthread_mutex_unlock(&qw_mutex);
+    } else if (qw.realtime - netchan.last_recv.time > CONNECT_TIMEOUT && con_state >= connected) {
+        qw_to_irc_print("Connection timed out. Reconnecting...\n", color_statusmessage);
+        net_disconnect();
+        net_reconnect();
+        qw.timeout_reconnect = qw.realtime;
     }
 
+    // Sum up the obituaries and pickups of a window that has run its length,
+    // and tell how much flooding players said
+    summary_frame();
+    flood_frame();
+
     // Check if thread termination was requested. Possible reasons are numerous.
-    pthread_mutex_lock(&qw_mutex);
-    if (!qw_running && con_state >= connected) {
+    qw_mutex_lock();
+    if (!qw_running) {
         pthread_mutex_unlock(&qw_mutex);
         qw_to_irc_print("Disconnected.\n", color_statusmessage);
+        qw_mutex_lock();
+        chat_report_unsent();
+        pthread_mutex_unlock(&qw_mutex);
         exec_chat("Bye bye!");
         net_disconnect();
         con_clear();
         pthread_exit(0);
-    } else if (con_state == active && irc_msg_buf[0]) {
-        // Send chat messages to server
-        exec_chat(irc_msg_buf);
-        irc_msg_buf[0] = 0;
+    } else if (con_state == active) {
+        // Send chat messages to server, paced to avoid being muted
+        chat_send();
     }
 
+    netstats_update();
+    rate_update();
+
     // Calculate resource usage every 60 seconds
     if (qw.realtime - res_last_calc > 60000) {
+        prof_enter(prof_rusage);
         if (!getrusage(RUSAGE_THREAD, &qw_rusage))
             qw_maxrss = qw_rusage.ru_maxrss;
         res_last_calc = qw.realtime;
+        prof_enter(prof_other);
     }
 
+    scoreboard_publish();
+    frags_publish();
+    latency_publish();
+    scrollback_publish();
+    filter_update();
+    prof_frame();
     pthread_mutex_unlock(&qw_mutex);
 }
@@ -0,0 +1,240 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Tagged allocations on top of qw_eggdrop_malloc for memory accounting,
+ * and the arena and slabs that keep the QuakeWorld thread off the heap
+ */
+
+memstat_t mem_stats[mem_count];
+memstat_t mem_total;
+const char *mem_tag_names[mem_count] = {"infostrings", "arena", "filter", "frags"};
+long arena_peak;
+
+// Heap block for an arena request that didn't fit
+typedef struct arena_overflow_s {
+    struct arena_overflow_s *next;
+    int mark;                           // Arena position when it was allocated
+} arena_overflow_t;
+
+// Rounds a size up so that what follows is aligned for any type
+#define ARENA_ALIGN(size)       (((size) + sizeof (long double) - 1) & ~(sizeof (long double) - 1))
+
+static __thread long double arena_buf[ARENA_SIZE / sizeof (long double)];
+static __thread int arena_used;
+static __thread arena_overflow_t *arena_overflow;
+
+// Placed in front of every allocation. The union keeps the memory that
+// follows it aligned for any type.
+typedef union {
+    struct {
+        int tag;
+        int size;                       // Including this header
+    } info;
+    long double align;
+} memhdr_t;
+
+/*
+==============
+mem_charge
+Adds size bytes, which may be negative, to a counter
+==============
+ */
+static void mem_charge(memstat_t *stat, long size) {
+    long live, peak;
+
+    live = __atomic_add_fetch(&stat->live, size, __ATOMIC_RELAXED);
+    if (size < 0)
+        return;
+    __atomic_add_fetch(&stat->allocs, 1, __ATOMIC_RELAXED);
+    // Raise the high-water mark unless another thread raised it past us
+    peak = __atomic_load_n(&stat->peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&stat->peak, &peak, live,
+            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+==============
+qw_malloc
+Allocates memory and charges it to a subsystem
+==============
+ */
+void *qw_malloc(memtag_t tag, int size) {
+    memhdr_t *hdr;
+
+    size += sizeof (memhdr_t);
+    hdr = qw_eggdrop_malloc(size);
+    hdr->info.tag = tag;
+    hdr->info.size = size;
+    mem_charge(&mem_stats[tag], size);
+    mem_charge(&mem_total, size);
+
+    return hdr + 1;
+}
+
+/*
+==============
+qw_free
+Frees memory allocated with qw_malloc
+==============
+ */
+void qw_free(void *pointer) {
+    memhdr_t *hdr;
+
+    if (!pointer)
+        return;
+
+    hdr = (memhdr_t *) pointer - 1;
+    mem_charge(&mem_stats[hdr->info.tag], -hdr->info.size);
+    mem_charge(&mem_total, -hdr->info.size);
+    qw_eggdrop_free(hdr);
+}
+
+/*
+==============
+arena_alloc
+Allocates memory from this thread's arena
+==============
+ */
+void *arena_alloc(int size) {
+    arena_overflow_t *block;
+    void *pointer;
+    long peak;
+
+    size = ARENA_ALIGN(size);
+
+    if (size > (int) sizeof (arena_buf) - arena_used) {
+        block = qw_malloc(mem_arena, ARENA_ALIGN(sizeof (arena_overflow_t)) + size);
+        block->next = arena_overflow;
+        block->mark = arena_used;
+        arena_overflow = block;
+        return (byte *) block + ARENA_ALIGN(sizeof (arena_overflow_t));
+    }
+
+    pointer = (byte *) arena_buf + arena_used;
+    arena_used += size;
+    // Every thread with an arena raises the same high-water mark
+    peak = __atomic_load_n(&arena_peak, __ATOMIC_RELAXED);
+    while (arena_used > peak && !__atomic_compare_exchange_n(&arena_peak, &peak, (long) arena_used,
+            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return pointer;
+}
+
+/*
+==============
+arena_mark
+Returns the arena position to give to arena_release() later
+==============
+ */
+int arena_mark(void) {
+    return arena_used;
+}
+
+/*
+==============
+arena_release
+Frees everything allocated from this thread's arena since the mark was taken
+==============
+ */
+void arena_release(int mark) {
+    arena_overflow_t *block;
+
+    while (arena_overflow && arena_overflow->mark >= mark) {
+        block = arena_overflow;
+        arena_overflow = block->next;
+        qw_free(block);
+    }
+    arena_used = mark;
+}
+
+/*
+==============
+slab_alloc
+Returns an object from a slab, taking a new chunk from the heap if all are in use
+==============
+ */
+void *slab_alloc(slab_t *slab) {
+    void **object;
+    int size, i;
+
+    if (!slab->free_list) {
+        // Objects must have room for the free list link
+        size = (MAX(slab->size, (int) sizeof (void *)) + sizeof (void *) - 1) & ~(sizeof (void *) - 1);
+        object = qw_malloc(slab->tag, sizeof (void *) + size * SLAB_CHUNK_OBJECTS);
+        *object = slab->chunks;
+        slab->chunks = object;
+
+        for (i = 0; i < SLAB_CHUNK_OBJECTS; i++) {
+            object = (void **) ((byte *) slab->chunks + sizeof (void *) + i * size);
+            *object = slab->free_list;
+            slab->free_list = object;
+        }
+    }
+
+    object = slab->free_list;
+    slab->free_list = *object;
+    slab->live++;
+    return object;
+}
+
+/*
+==============
+slab_free
+Returns an object to its slab. When the last object is freed, the chunks
+go back to the heap.
+==============
+ */
+void slab_free(slab_t *slab, void *object) {
+    void *chunk;
+
+    if (!object)
+        return;
+
+    *(void **) object = slab->free_list;
+    slab->free_list = object;
+
+    if (--slab->live)
+        return;
+
+    while (slab->chunks) {
+        chunk = slab->chunks;
+        slab->chunks = *(void **) chunk;
+        qw_free(chunk);
+    }
+    slab->free_list = NULL;
+}
+
+/*
+==============
+mem_session
+Returns the size of the fixed buffers a QuakeWorld session works in. These
+are static, so they don't show up in the tagged allocations.
+==============
+ */
+long mem_session(void) {
+    return sizeof (netchan) + sizeof (qw) + sizeof (net_message_buffer)
+            + sizeof (chatmsg_t) * CHAT_QUEUE_LEN + sizeof (net_stats)
+            + sizeof (latency) + sizeof (profiler) + sizeof (entity_baselines)
+            + sizeof (entity_frames) + sizeof (frag_log)
+            + sizeof (summary) + sizeof (dedupe) + sizeof (flood)
+            + sizeof (scrollback);
+}
@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Metrics registry and the Prometheus text format export
+ */
+
+static uint64_t metrics_qw[metric_count];       // Owned by the QuakeWorld thread
+static uint64_t metrics_shared[metric_count];   // Everyone else, updated atomically
+static __thread uint64_t *metrics_local;        // metrics_qw in the QuakeWorld thread
+
+static const char *svc_names[svc_count + 1] = {
+    "bad", "nop", "disconnect", "updatestat", "version", "setview", "sound", "time",
+    "print", "stufftext", "setangle", "serverdata", "lightstyle", "updatename",
+    "updatefrags", "clientdata", "stopsound", "updatecolors", "particle", "damage",
+    "spawnstatic", "spawnbinary", "spawnbaseline", "temp_entity", "setpause",
+    "signonnum", "centerprint", "killedmonster", "foundsecret", "spawnstaticsound",
+    "intermission", "finale", "cdtrack", "sellscreen", "smallkick", "bigkick",
+    "updateping", "updateentertime", "updatestatlong", "muzzleflash",
+    "updateuserinfo", "download", "playerinfo", "nails", "chokecount", "modellist",
+    "soundlist", "packetentities", "deltapacketentities", "maxspeed", "entgravity",
+    "setinfo", "serverinfo", "updatepl", "unknown"
+};
+
+// Counters written out together under one name
+typedef struct {
+    char *name;
+    char *help;
+    metric_t first;
+    int count;
+    char *label;                                // Tells the counters apart, if more than one
+    const char **values;
+} metricfamily_t;
+
+static const char *direction_names[] = {"in", "out"};
+
+static metricfamily_t metric_families[] = {
+    {"qwirc_packets_total", "Datagrams exchanged with the QuakeWorld server.",
+        metric_packets_in, 2, "direction", direction_names},
+    {"qwirc_bytes_total", "Bytes exchanged with the QuakeWorld server.",
+        metric_bytes_in, 2, "direction", direction_names},
+    {"qwirc_reconnects_total", "Reconnects completed after a timeout or map change.",
+        metric_reconnects, 1, NULL, NULL},
+    {"qwirc_reliable_retransmits_total", "Reliable messages sent to the server again.",
+        metric_retransmits, 1, NULL, NULL},
+    {"qwirc_choked_packets_total", "Datagrams the server skipped to keep to our rate.",
+        metric_choked, 1, NULL, NULL},
+    {"qwirc_kills_total", "Obituaries recognized with the fragfile, by kind of death.",
+        metric_kills, kill_count, "kind", kill_kind_names},
+    {"qwirc_lines_relayed_total", "Lines of QuakeWorld text sent to IRC.",
+        metric_relayed, relay_count, "class", relay_class_names},
+    {"qwirc_lines_deduped_total", "Lines of server text not relayed again within qw_dedupe_ttl.",
+        metric_deduped, relay_count, "class", relay_class_names},
+    {"qwirc_lines_limited_total", "Lines not relayed because of qw_relay_limits.",
+        metric_limited, relay_count, "class", relay_class_names},
+    {"qwirc_chat_flood_lines_total", "Chat lines held back from players saying too much too fast.",
+        metric_flooded, 1, NULL, NULL},
+    {"qwirc_prints_filtered_total", "Server prints skipped because of qw_print_filter.",
+        metric_filtered, PRINT_LEVELS, "level", print_level_names},
+    {"qwirc_server_messages_total", "Server messages parsed, by type.",
+        metric_svc, svc_count + 1, "svc", svc_names},
+    {NULL, NULL, 0, 0, NULL, NULL}
+};
+
+/*
+==============
+metrics_thread_start
+Makes the calling thread the owner of the QuakeWorld thread's counters.
+Only one such thread may run at a time.
+==============
+ */
+void metrics_thread_start(void) {
+    metrics_local = metrics_qw;
+}
+
+/*
+==============
+metric_add
+Adds n to a counter. Replays don't count.
+==============
+ */
+void metric_add(metric_t metric, uint64_t n) {
+    if (capture_replaying)
+        return;
+
+    // A plain load and store, but readers in other threads must see whole values
+    if (metrics_local)
+        __atomic_store_n(&metrics_local[metric], metrics_local[metric] + n, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&metrics_shared[metric], n, __ATOMIC_RELAXED);
+}
+
+/*
+==============
+metric_value
+Returns the current value of a counter
+==============
+ */
+uint64_t metric_value(metric_t metric) {
+    return __atomic_load_n(&metrics_qw[metric], __ATOMIC_RELAXED)
+            + __atomic_load_n(&metrics_shared[metric], __ATOMIC_RELAXED);
+}
+
+/*
+==============
+metrics_write_histogram
+Writes a latency histogram in seconds, with power of two buckets from 64 us
+to about 16 s
+==============
+ */
+static void metrics_write_histogram(FILE *f, char *name, char *help, histogram_t *h) {
+    uint32_t total = h->total;
+    int i;
+
+    fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (i = 6; i <= 24; i++)
+        fprintf(f, "%s_bucket{le=\"%g\"} %u\n", name, (1 << i) / 1e6,
+                MIN(histogram_count_below(h, 1 << i), total));
+    fprintf(f, "%s_bucket{le=\"+Inf\"} %u\n", name, total);
+    fprintf(f, "%s_sum %g\n%s_count %u\n", name, h->sum / 1e6, name, total);
+}
+
+/*
+==============
+metrics_write
+Writes all metrics to a file in the Prometheus text format, for the node
+exporter textfile collector. The file is written under a temporary name
+and renamed over the old one, so readers never see it half-written.
+Returns false on error.
+==============
+ */
+bool metrics_write(char *path) {
+    char tmp[MAX_OSPATH + 8];
+    metricfamily_t *fam;
+    FILE *f;
+    int i, chat, commands, reliable, rate;
+    latency_t lat;
+    bool in_game;
+
+    snprintf(tmp, sizeof (tmp), "%s.tmp", path);
+    if (!(f = fopen(tmp, "w"))) {
+        printf("Error: Can't open %s: %s. (metrics_write())\n", tmp, strerror(errno));
+        return false;
+    }
+
+    for (fam = metric_families; fam->name; fam++) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", fam->name, fam->help, fam->name);
+        for (i = 0; i < fam->count; i++) {
+            // Most server message types never show up, leave them out
+            if (fam->first == metric_svc && !metric_value(fam->first + i))
+                continue;
+            if (fam->label)
+                fprintf(f, "%s{%s=\"%s\"} %llu\n", fam->name, fam->label, fam->values[i],
+                        (unsigned long long) metric_value(fam->first + i));
+            else
+                fprintf(f, "%s %llu\n", fam->name, (unsigned long long) metric_value(fam->first + i));
+        }
+    }
+
+    // Gauges are sampled from the QuakeWorld thread's state
+    qw_mutex_lock();
+    in_game = con_state == active;
+    chat = chat_queued();
+    reliable = netchan.reliable_length + netchan.message.cur_size;
+    rate = qw.rate;
+    lat = latency_shared;
+    for (i = commands = 0; i < pri_count; i++)
+        commands += netchan.cmd_queue[i].cur_size;
+    pthread_mutex_unlock(&qw_mutex);
+
+    fprintf(f, "# HELP qwirc_connected Whether the bot is in the game.\n"
+            "# TYPE qwirc_connected gauge\nqwirc_connected %d\n", in_game);
+    fprintf(f, "# HELP qwirc_chat_queue_depth Chat messages waiting to be sent to the server.\n"
+            "# TYPE qwirc_chat_queue_depth gauge\nqwirc_chat_queue_depth %d\n", chat);
+    fprintf(f, "# HELP qwirc_command_queue_bytes Commands waiting to be packed into a datagram.\n"
+            "# TYPE qwirc_command_queue_bytes gauge\nqwirc_command_queue_bytes %d\n", commands);
+    fprintf(f, "# HELP qwirc_reliable_pending_bytes Reliable data not yet acknowledged by the server.\n"
+            "# TYPE qwirc_reliable_pending_bytes gauge\nqwirc_reliable_pending_bytes %d\n", reliable);
+    fprintf(f, "# HELP qwirc_rate_bytes Rate in the bot's userinfo, in bytes per second.\n"
+            "# TYPE qwirc_rate_bytes gauge\nqwirc_rate_bytes %d\n", rate);
+    fprintf(f, "# HELP qwirc_memory_bytes Memory allocated by the module.\n"
+            "# TYPE qwirc_memory_bytes gauge\n");
+    for (i = 0; i < mem_count; i++)
+        fprintf(f, "qwirc_memory_bytes{subsystem=\"%s\"} %ld\n", mem_tag_names[i], mem_stats[i].live);
+
+    metrics_write_histogram(f, "qwirc_relay_latency_seconds",
+            "Time from receiving a datagram to handing the text to IRC.", &lat.relay);
+    metrics_write_histogram(f, "qwirc_say_latency_seconds",
+            "Time from !qsay to sending the datagram carrying it.", &lat.say);
+
+    if (fclose(f) || rename(tmp, path)) {
+        printf("Error: Can't write %s: %s. (metrics_write())\n", path, strerror(errno));
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
@@ -25,6 +25,12 @@ netadr_t net_from;                              // Remote host
 netbuf_t net_message;                           // Network message
 int net_socket;                                 // UDP socket
 byte net_message_buffer[MAX_UDP_PACKET];        // Network message buffer
+uint64_t net_recv_stamp;                        // Receive time of the current datagram
+netstats_t net_stats;                           // Traffic counters
+
+game_instance_t qw;                             // Current game
+constate_t con_state;                           // Connection state
+netchan_t netchan;                              // Network channel to the server
 
 /*
  * Network channel functions for connection-oriented transmission
@@ -33,17 +39,236 @@ byte net_message_buffer[MAX_UDP_PACKET];        // Network message buffer
 /*
 ===============
 netchan_keepalive
-Sends some fake game data to the server so that we also get some data back
+Sends a null movement command to the server so that we also get some data
+back. The server only sends a datagram in reply to one from us.
 ===============
  */
 void netchan_keepalive(void) {
-    // The client command tmove is harmless enough.
-    net_write_integer(&netchan.message, clc_tmove, 1);
-    // The server expects three short integers as coordinates for tmove.
-    // Might just use the value 1 for each, doesn't matter.
-    net_write_integer(&netchan.message, 1, 2);
-    net_write_integer(&netchan.message, 1, 2);
-    net_write_integer(&netchan.message, 1, 2);
+    int i, msec, checksum;
+
+    // Ask for entities as a delta from the last frame we got, unless the
+    // server has already overwritten that frame
+    if (qw.valid_sequence && netchan.last_sent.seq - qw.valid_sequence < UPDATE_BACKUP - 1) {
+        net_write_integer(&netchan.datagram, clc_delta, 1);
+        net_write_integer(&netchan.datagram, qw.valid_sequence & 0xFF, 1);
+    }
+
+    // clc_move has to be the last command in the datagram: if the server
+    // doesn't like its checksum, it ignores the rest of the datagram.
+    net_write_integer(&netchan.datagram, clc_move, 1);
+    checksum = netchan.datagram.cur_size;     // Filled in once the move is written
+    net_write_integer(&netchan.datagram, 0, 1);
+    net_write_integer(&netchan.datagram, netchan.loss.percent, 1);
+
+    // Oldest, previous and current usercmd, each a delta from the one before.
+    // Nothing changes, so only the mandatory msec byte is written.
+    msec = MIN(MAX(qw.realtime - netchan.last_move, 0), 250);
+    netchan.last_move = qw.realtime;
+    for (i = 0; i < 3; i++) {
+        net_write_integer(&netchan.datagram, 0, 1);
+        net_write_integer(&netchan.datagram, msec, 1);
+    }
+
+    // The checksum covers what follows it, salted by the sequence number
+    // this datagram goes out with
+    netchan.datagram.data[checksum] = sequence_crc_byte(netchan.datagram.data + checksum + 1,
+            netchan.datagram.cur_size - checksum - 1, netchan.last_sent.seq);
+
+    // Back off while the server has nothing for us
+    netchan.keepalive_interval = MIN(netchan.keepalive_interval * 2, KEEPALIVE_MAX);
+}
+
+/*
+===============
+netchan_keepalive_due
+Checks whether a keepalive should go out in this frame: when the adaptive
+interval has passed, or when a datagram is going out anyway
+===============
+ */
+bool netchan_keepalive_due(netchan_t *chan) {
+    int pri;
+
+    if (qw.realtime - chan->last_sent.time >= chan->keepalive_interval)
+        return true;
+    if (chan->message.cur_size)
+        return true;
+    for (pri = 0; pri < pri_count; pri++)
+        if (chan->cmd_queue[pri].cur_size)
+            return true;
+
+    return false;
+}
+
+/*
+===============
+netchan_stringcmd
+Queues a string command to be packed into the next datagram with room for it
+===============
+ */
+void netchan_stringcmd(netchan_t *chan, cmdpri_t pri, char *cmd) {
+    netbuf_t *queue = &chan->cmd_queue[pri];
+    int len = strlen(cmd) + 1;
+
+    // Nothing longer fits in a datagram after the header and qport
+    if (1 + len > MAX_MSG_LEN - QW_QPORT_LEN) {
+        printf("Error: Command too long, dropped '%.32s...'. (netchan_stringcmd())\n", cmd);
+        return;
+    }
+
+    // The queue is drained every frame, so this only happens when flooded
+    if (queue->cur_size + 1 + len > queue->max_size) {
+        printf("Error: Command queue %d full, dropped '%s'. (netchan_stringcmd())\n", pri, cmd);
+        return;
+    }
+
+    net_write_integer(queue, clc_stringcmd, 1);
+    buf_write(queue, cmd, len);
+
+    if (pri == pri_chat && chan->say_count < MAX_QUEUED_SAYS)
+        chan->say_stamps[chan->say_count++] = chan->say_stamp;
+    chan->say_stamp = 0;
+}
+
+/*
+===============
+netchan_says_sent
+Forgets the stamps of the says that were packed into the reliable message,
+recording their latency if the message was sent
+===============
+ */
+void netchan_says_sent(netchan_t *chan, bool sent) {
+    int i;
+
+    if (sent)
+        for (i = 0; i < chan->say_packed; i++)
+            latency_record(&latency.say, chan->say_stamps[i]);
+
+    chan->say_count -= chan->say_packed;
+    memmove(chan->say_stamps, chan->say_stamps + chan->say_packed, chan->say_count * sizeof (chan->say_stamps[0]));
+    chan->say_packed = 0;
+}
+
+/*
+===============
+netchan_pack
+Moves queued string commands into the reliable message in priority order,
+filling the datagram up to the path MTU. Commands that don't fit wait for
+the next datagram, except one too long for any datagram, which goes out on
+its own when nothing else is.
+===============
+ */
+void netchan_pack(netchan_t *chan) {
+    netbuf_t *queue;
+    int pri, room, len, cmd_len;
+    bool empty;
+
+    room = chan->mtu - QW_HEADER_LEN - QW_QPORT_LEN - chan->datagram.cur_size;
+    // A reliable message that's still unacknowledged will be resent in the same datagram
+    room -= MAX(chan->reliable_length, chan->message.cur_size);
+    room = MIN(room, chan->message.max_size - chan->message.cur_size);
+    empty = !chan->reliable_length && !chan->message.cur_size;
+
+    for (pri = 0; pri < pri_count; pri++) {
+        queue = &chan->cmd_queue[pri];
+
+        // Count whole commands that fit: command byte, string and terminating 0.
+        // The queue is no bigger than the message, so an empty one takes any
+        // command, even if the unreliable part then has to stay behind.
+        for (len = 0; len < queue->cur_size; len += cmd_len) {
+            cmd_len = strlen((char *) queue->data + len + 1) + 2;
+            if (cmd_len > room && !empty)
+                break;
+            empty = false;
+            room -= cmd_len;
+            if (pri == pri_chat)
+                chan->say_packed++;
+        }
+
+        if (len) {
+            buf_write(&chan->message, queue->data, len);
+            memmove(queue->data, queue->data + len, queue->cur_size - len);
+            queue->cur_size -= len;
+        }
+
+        // Lower priorities must not overtake the ones still waiting
+        if (queue->cur_size)
+            break;
+    }
+}
+
+/*
+===============
+netstats_update
+Recalculates traffic rates once per NETSTATS_PERIOD. Call with qw_mutex held.
+===============
+ */
+void netstats_update(void) {
+    netstats_t *ns = &net_stats;
+    float elapsed = qw.realtime - ns->last.time;
+    uint64_t bytes_in = metric_value(metric_bytes_in), bytes_out = metric_value(metric_bytes_out);
+
+    if (elapsed < NETSTATS_PERIOD)
+        return;
+
+    ns->rate_in = (bytes_in - ns->last.bytes_in) * 1000 / elapsed;
+    ns->rate_out = (bytes_out - ns->last.bytes_out) * 1000 / elapsed;
+    ns->rate_entity_full = (ns->entity_full_bytes - ns->last.entity_full_bytes) * 1000 / elapsed;
+    ns->rate_entity_delta = (ns->entity_delta_bytes - ns->last.entity_delta_bytes) * 1000 / elapsed;
+
+    if (ns->active_time + (ns->active_since ? qw.realtime - ns->active_since : 0) > 0)
+        ns->packets_per_hour = __atomic_load_n(&ns->active_packets_out, __ATOMIC_RELAXED)
+            * 3600000.0f
+            / (ns->active_time + (ns->active_since ? qw.realtime - ns->active_since : 0));
+
+    ns->last.time = qw.realtime;
+    ns->last.bytes_in = bytes_in;
+    ns->last.bytes_out = bytes_out;
+    ns->last.entity_full_bytes = ns->entity_full_bytes;
+    ns->last.entity_delta_bytes = ns->entity_delta_bytes;
+}
+
+/*
+===============
+rate_update
+Adapts the rate in our userinfo once per RATE_PERIOD. The server skips
+("chokes") datagrams that would take us over our rate, so choke on
+datagrams that carry text for IRC means the rate is too low, and it's
+raised by half. Otherwise it's lowered by an eighth, unless packets are
+being lost, but not back down to where choke was seen on this map, or
+below RATE_MIN. qw_rate is the ceiling. Call with qw_mutex held.
+===============
+ */
+void rate_update(void) {
+    char value[16], cmd[32];
+    int rate = qw.rate;
+
+    if (qw.realtime - qw.rate_period < RATE_PERIOD)
+        return;
+
+    // Only a full period in the game tells anything
+    if (con_state == active && qw.rate_period) {
+        if (qw.rate_choked) {
+            qw.rate_floor = MAX(qw.rate_floor, rate + rate / 8);
+            rate += rate / 2;
+        } else if (netchan.loss.percent <= RATE_LOSS)
+            rate = MAX(rate - rate / 8, qw.rate_floor);
+    }
+    rate = MIN(MAX(rate, RATE_MIN), qw_rate);
+    qw.rate_period = con_state == active ? qw.realtime : 0;
+    qw.rate_choked = 0;
+
+    if (rate == qw.rate)
+        return;
+
+    qw.rate = rate;
+    snprintf(value, sizeof (value), "%d", rate);
+    infostring_update_node(userinfo_root, "rate", value);
+    // Connect with the adapted rate next time
+    qw.userinfo[0] = 0;
+    if (con_state >= connected) {
+        snprintf(cmd, sizeof (cmd), "setinfo rate %d", rate);
+        netchan_stringcmd(&netchan, pri_command, cmd);
+    }
 }
 
 /*
@@ -75,14 +300,24 @@ Sets up the network channel used for all connection-oriented traffic
 ==============
  */
 void netchan_setup(netchan_t *chan, netadr_t adr, int qport) {
+    int pri;
+
     memset(chan, 0, sizeof (*chan));
 
     chan->remote_address = adr;
     chan->last_recv.time = qw.realtime;
+    // Servers drop sequence 0 as already seen, so start from 1 like id's client
+    chan->last_sent.seq = 1;
+    chan->mtu = netadr_path_mtu(adr);
+    chan->keepalive_interval = KEEPALIVE_MIN;
 
     chan->message.data = chan->message_buf;
     chan->message.max_size = sizeof (chan->message_buf);
 
+    buf_init(&chan->datagram, chan->datagram_buf, sizeof (chan->datagram_buf));
+    for (pri = 0; pri < pri_count; pri++)
+        buf_init(&chan->cmd_queue[pri], chan->cmd_queue_buf[pri], sizeof (chan->cmd_queue_buf[pri]));
+
     chan->qport = qport;
 }
 
@@ -95,14 +330,14 @@ Transmits all outgoing connection-oriented traffic. Handles reliability.
 void netchan_transmit(netchan_t *chan, int length, byte *data) {
     netbuf_t send;
     byte send_buf[MAX_MSG_LEN + QW_HEADER_LEN];
-    bool rel_payload = false;
+    bool rel_payload = false, new_reliable = false;
     uint32_t header_seq, header_ack;
 
     // Check for buffer overflow
     if (chan->message.overflowed) {
         qw_to_irc_print("Fatal error: outgoing message overflow!\n", color_statusmessage);
         // Signal thread to be shut down
-        pthread_mutex_lock(&qw_mutex);
+        qw_mutex_lock();
         qw_running = false;
         pthread_mutex_unlock(&qw_mutex);
         return;
@@ -121,6 +356,7 @@ void netchan_transmit(netchan_t *chan, int length, byte *data) {
         chan->message.cur_size = 0;
         chan->last_sent.rel_flag ^= 1;
         rel_payload = true;
+        new_reliable = true;
     }
 
     send.data = send_buf;
@@ -128,8 +364,8 @@ void netchan_transmit(netchan_t *chan, int length, byte *data) {
     send.cur_size = 0;
 
     // Store header integers
-    header_seq = chan->last_sent.seq | (rel_payload << 31);
-    header_ack = chan->last_recv.seq | (chan->last_recv.rel_flag << 31);
+    header_seq = chan->last_sent.seq | ((uint32_t) rel_payload << 31);
+    header_ack = chan->last_recv.seq | ((uint32_t) chan->last_recv.rel_flag << 31);
 
     // Update stats
     chan->last_sent.seq++;
@@ -147,11 +383,17 @@ void netchan_transmit(netchan_t *chan, int length, byte *data) {
     }
 
     // Add the unreliable part if there is still space left
-    if (send.max_size - send.cur_size >= length)
+    if (chan->mtu - send.cur_size >= length)
         buf_write(&send, data, length);
 
     // Send datagram
     udp_transmit(send.cur_size, send.data, chan->remote_address);
+
+    // Says in a new reliable message are on their way now
+    if (new_reliable)
+        netchan_says_sent(chan, true);
+    else if (rel_payload)
+        metric_add(metric_retransmits, 1);
 }
 
 /*
@@ -177,13 +419,26 @@ bool netchan_process(netchan_t *chan) {
     rel_acked_flag = header_ack >> 31;
 
     // Remove reliable flags to get the sequence numbers
-    header_seq &= ~(1 << 31);
-    header_ack &= ~(1 << 31);
+    header_seq &= ~(1u << 31);
+    header_ack &= ~(1u << 31);
 
     // Discard stale or duplicated packets
     if (header_seq <= chan->last_recv.seq)
         return false;
 
+    // Packet loss is reported back to the server in samples of 100 packets.
+    // A jump in the sequence can't lose more than a whole sample.
+    chan->loss.dropped += MIN(header_seq - chan->last_recv.seq - 1, 100);
+    if (++chan->loss.received + chan->loss.dropped >= 100) {
+        chan->loss.percent = chan->loss.dropped * 100 / (chan->loss.received + chan->loss.dropped);
+        chan->loss.received = chan->loss.dropped = 0;
+    }
+
+    // Reliable data usually means prints that we want to relay without
+    // delay, so keep asking for more at the full rate
+    if (rel_payload)
+        chan->keepalive_interval = KEEPALIVE_MIN;
+
     // If the current outgoing reliable message has been acknowledged
     // clear the buffer to make way for the next
     if (rel_acked_flag == chan->last_sent.rel_flag)
@@ -193,6 +448,7 @@ bool netchan_process(netchan_t *chan) {
     chan->last_recv.seq = header_seq;
     chan->last_recv.remote_acked_seq = header_ack;
     chan->last_recv.remote_acked_rel_flag = rel_acked_flag;
+    chan->last_recv.reliable = rel_payload;
     if (rel_payload)
         chan->last_recv.rel_flag ^= 1;
     chan->last_recv.time = qw.realtime;
@@ -256,6 +512,36 @@ char *netadr_to_string(netadr_t a) {
     return adr_str;
 }
 
+/*
+=====================
+netadr_path_mtu
+Asks the kernel for the path MTU towards an address and returns the largest
+UDP payload that fits in it
+=====================
+ */
+int netadr_path_mtu(netadr_t a) {
+    struct sockaddr_in addr;
+    int sock, mtu = 0;
+    socklen_t len = sizeof (mtu);
+
+    // Route MTU is only known for a connected socket, so use a throwaway one
+    netadr_to_saddr(&a, &addr);
+    if ((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) != -1) {
+        if (connect(sock, (struct sockaddr *) &addr, sizeof (addr)) == -1
+                || getsockopt(sock, IPPROTO_IP, IP_MTU, &mtu, &len) == -1)
+            mtu = 0;
+        close(sock);
+    }
+
+    // Subtract IP and UDP headers
+    if (mtu)
+        mtu -= 28;
+    if (mtu < MIN_PATH_MTU)
+        mtu = MIN_PATH_MTU;
+
+    return MIN(mtu, MAX_MSG_LEN + QW_HEADER_LEN);
+}
+
 /*
 =============
 string_to_netadr
@@ -274,7 +560,8 @@ bool string_to_netadr(char *s, netadr_t *a) {
 
     saddr.sin_port = 0;
 
-    strncpy(copy, s, sizeof(copy));
+    strncpy(copy, s, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = 0;
     // strip off a trailing :port if present
     for (colon = copy; *colon; colon++)
         if (*colon == ':') {
@@ -335,10 +622,25 @@ Processes incoming UDP datagrams
 bool udp_process(void) {
     int ret;
     struct sockaddr_in from;
-    int fromlen;
-
-    fromlen = sizeof (from);
-    ret = recvfrom(net_socket, net_message_buffer, sizeof (net_message_buffer), 0, (struct sockaddr *) &from, (socklen_t *) & fromlen);
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof (struct timespec))];
+    struct timespec *ts;
+
+    prof_enter(prof_receive);
+
+    iov.iov_base = net_message_buffer;
+    iov.iov_len = sizeof (net_message_buffer);
+    memset(&msg, 0, sizeof (msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof (from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+
+    ret = recvmsg(net_socket, &msg, 0);
     if (ret == -1) {
         if (errno == EWOULDBLOCK) {
             return false;
@@ -352,9 +654,43 @@ bool udp_process(void) {
     net_message.cur_size = ret;
     saddr_to_netadr(&from, &net_from);
 
+    // Prefer the kernel's receive timestamp, it includes time spent queued
+    net_recv_stamp = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            ts = (struct timespec *) CMSG_DATA(cmsg);
+            net_recv_stamp = (uint64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+        }
+    if (!net_recv_stamp)
+        net_recv_stamp = latency_now();
+
+    metric_add(metric_packets_in, 1);
+    metric_add(metric_bytes_in, ret);
+
+    capture_write();
+    flight_record(false, net_message_buffer, ret);
+
     return ret;
 }
 
+/*
+=====================
+udp_wait
+Sleeps until a datagram arrives or msec milliseconds have passed
+=====================
+ */
+void udp_wait(int msec) {
+    fd_set fds;
+    struct timeval tv;
+
+    FD_ZERO(&fds);
+    FD_SET(net_socket, &fds);
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+
+    select(net_socket + 1, &fds, NULL, NULL, &tv);
+}
+
 /*
 =====================
 udp_transmit
@@ -365,9 +701,10 @@ void udp_transmit(int length, void *data, netadr_t to) {
     int ret;
     struct sockaddr_in addr;
 
-    if (!to.ip.as_int)
+    if (!to.ip.as_int || capture_replaying)
         return;
 
+    flight_record(true, data, length);
     netadr_to_saddr(&to, &addr);
     ret = sendto(net_socket, data, length, 0, (struct sockaddr *) &addr, sizeof (addr));
     if (ret == -1) {
@@ -376,8 +713,13 @@ void udp_transmit(int length, void *data, netadr_t to) {
         if (errno == ECONNREFUSED)
             return;
         printf("Error: sendto() returned: %s. (udp_transmit())\n", strerror(errno));
-
+        return;
     }
+
+    metric_add(metric_packets_out, 1);
+    metric_add(metric_bytes_out, ret);
+    if (net_stats.active_since)
+        __atomic_add_fetch(&net_stats.active_packets_out, 1, __ATOMIC_RELAXED);
 }
 
 /*
@@ -391,6 +733,7 @@ int udp_open(int port) {
     struct sockaddr_in address;
     char err_str[100];
     char non_blocking = 1;
+    int on = 1;
 
     if ((qw_socket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
         snprintf(err_str, sizeof(err_str), "Error: socket() returned %s. (udp_open())\n", strerror(errno));
@@ -400,6 +743,9 @@ int udp_open(int port) {
         snprintf(err_str, sizeof(err_str), "Error: ioctl() returned %s. (udp_open())\n", strerror(errno));
         qw_to_irc_print(err_str, color_statusmessage);
     }
+    // Receive timestamps for the latency histograms, optional
+    setsockopt(qw_socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on));
+
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
 
@@ -423,6 +769,9 @@ void con_init(int port) {
     // Open and set up the UDP socket used for QuakeWorld communications
     net_socket = udp_open(port);
 
+    memset(&net_stats, 0, sizeof (net_stats));
+    net_stats.last.time = qw.realtime;
+
     // Init the message buffer
     net_message.max_size = sizeof (net_message_buffer);
     net_message.data = net_message_buffer;
@@ -430,7 +779,7 @@ void con_init(int port) {
     // Get local network address and name
     netadr_local_setup();
 
-    con_state = disconnected;
+    con_set_state(disconnected);
     qw_to_irc_print("QuakeWorld UDP Initialized.\n", color_statusmessage);
 
     // Assign a random qport number
@@ -438,6 +787,23 @@ void con_init(int port) {
 
 }
 
+/*
+====================
+con_set_state
+Changes the connection state and keeps track of time spent in-game
+====================
+ */
+void con_set_state(constate_t state) {
+    if (state == active && con_state != active)
+        net_stats.active_since = qw.realtime;
+    else if (state != active && con_state == active) {
+        net_stats.active_time += qw.realtime - net_stats.active_since;
+        net_stats.active_since = 0;
+    }
+
+    con_state = state;
+}
+
 /*
 ====================
 con_clear
@@ -446,9 +812,14 @@ Clears and frees networking structs and the UDP socket
  */
 void con_clear(void) {
     close(net_socket);
+    capture_close();
     memset(&netchan, 0, sizeof (netchan_t));
     infostring_clear(userinfo_root, true);
     infostring_clear(serverinfo_root, true);
+    scoreboard_clear();
+    qw_mutex_lock();
+    scoreboard_publish();
+    pthread_mutex_unlock(&qw_mutex);
 }
 
 /*
@@ -462,12 +833,14 @@ net_parse_command
 =====================
  */
 void net_parse_command(void) {
-    int cmd;
+    int cmd, slot, value, level;
+    float seconds;
     bool read_msg = true;
 
     while (1 && read_msg) {
         if (net_read_err) {
             printf("Error: Bad server message. (net_parse_command())\n");
+            flight_note("bad server message");
             break;
         }
 
@@ -478,6 +851,8 @@ void net_parse_command(void) {
             break;
         }
 
+        metric_add(metric_svc + MIN(cmd, svc_count), 1);
+
         // Act on command
         switch (cmd) {
             case svc_nop:
@@ -491,8 +866,15 @@ void net_parse_command(void) {
                 break;
 
             case svc_print:
-                net_skip_bytes(1);
-                
+                // Levels filtered out this session are skipped before the
+                // text is copied anywhere
+                level = net_read_bytes(1);
+                if (level >= 0 && level < PRINT_LEVELS && (qw.print_filter & (1 << level))) {
+                    net_skip_string();
+                    metric_add(metric_filtered + level, 1);
+                    break;
+                }
+
                 char cur_line[MAX_STRING_CHARS];
                 // Get string
                 char* original = net_read_string(false);
@@ -501,8 +883,8 @@ void net_parse_command(void) {
 
                 while (lines != NULL) {
                     // Add "\n" because the result of strtok doesn't include the token
-                    snprintf(cur_line, strlen(lines) + 2, "%s\n", lines);
-                    qw_to_irc_print(cur_line, color_chattext);
+                    snprintf(cur_line, sizeof (cur_line), "%s\n", lines);
+                    qw_to_irc_print_level(cur_line, level);
 
                     // Get next line
                     lines = strtok(NULL, "\n");
@@ -510,7 +892,7 @@ void net_parse_command(void) {
                 break;
 
             case svc_centerprint:
-                net_read_string(false);
+                exec_centerprint(net_read_string(false));
                 break;
 
             case svc_stufftext:
@@ -530,27 +912,111 @@ void net_parse_command(void) {
                 break;
 
             case svc_setinfo:
-                exec_setinfo(userinfo_root);
+                exec_setinfo();
                 break;
 
             case svc_serverinfo:
-                exec_setinfo(serverinfo_root);
+                exec_serverinfo();
+                break;
+
+            case svc_updatefrags:
+                slot = net_read_bytes(1);
+                value = (short) net_read_bytes(2);
+                if (slot >= 0 && slot < MAX_CLIENTS) {
+                    scoreboard.frags[slot] = value;
+                    scoreboard.changed = true;
+                }
+                break;
+
+            case svc_updateping:
+                slot = net_read_bytes(1);
+                value = (short) net_read_bytes(2);
+                if (slot >= 0 && slot < MAX_CLIENTS) {
+                    scoreboard.ping[slot] = value;
+                    scoreboard.changed = true;
+                }
+                break;
+
+            case svc_updatepl:
+                slot = net_read_bytes(1);
+                value = net_read_bytes(1);
+                if (slot >= 0 && slot < MAX_CLIENTS) {
+                    scoreboard.pl[slot] = value;
+                    scoreboard.changed = true;
+                }
+                break;
+
+            // Seconds the player has been on the server
+            case svc_updateentertime:
+                slot = net_read_bytes(1);
+                value = net_read_bytes(4);
+                if (slot >= 0 && slot < MAX_CLIENTS) {
+                    memcpy(&seconds, &value, sizeof (seconds));
+                    scoreboard.entertime[slot] = qw.realtime - seconds * 1000;
+                    scoreboard.changed = true;
+                }
                 break;
                 
             case svc_sound:
                 exec_sound();
                 break;
+
+            // Datagrams the server skipped since the last one it sent.
+            // Those matter if they held up the reliable text in this one.
+            case svc_chokecount:
+                value = net_read_bytes(1);
+                if (value > 0) {
+                    metric_add(metric_choked, value);
+                    if (netchan.last_recv.reliable)
+                        qw.rate_choked += value;
+                }
+                break;
                 
-            // Skip some messages entirely
-            case svc_playerinfo:
+            // The server keeps a copy of every entity frame it sends, so
+            // from now on it can send deltas against a frame that decoded
             case svc_packetentities:
+                value = net_read_count - 1;
+                entities_parse(false);
+                net_stats.entity_full_bytes += net_read_count - value;
+                break;
+
             case svc_deltapacketentities:
-                net_skip_message();
-                read_msg = false;
+                value = net_read_count - 1;
+                entities_parse(true);
+                net_stats.entity_delta_bytes += net_read_count - value;
                 break;
-                
+
+            case svc_playerinfo:
+                entities_playerinfo();
+                break;
+
+            case svc_spawnbaseline:
+                entities_baseline();
+                break;
+
+            case svc_spawnstatic:
+                entities_static();
+                break;
+
+            case svc_temp_entity:
+                exec_temp_entity();
+                break;
+
+            // Lists of nails in flight, 6 bytes each
+            case svc_nails:
+                net_skip_bytes(net_read_bytes(1) * 6);
+                break;
+
             // With the rest we skip just enough bytes to read the next command
+            case svc_smallkick:
+            case svc_bigkick:
+            case svc_killedmonster:
+            case svc_foundsecret:
+            case svc_sellscreen:
+                break;
+
             case svc_cdtrack:
+            case svc_setpause:
                 net_skip_bytes(1);
                 break;
                 
@@ -559,14 +1025,12 @@ void net_parse_command(void) {
                 net_read_string(false);
                 break;
                 
-            case svc_updatepl:
             case svc_updatestat:
             case svc_stopsound:
+            case svc_muzzleflash:
                 net_skip_bytes(2);
                 break;
                 
-            case svc_updatefrags:
-            case svc_updateping:
             case svc_setangle:
                 net_skip_bytes(3);
                 break;
@@ -577,17 +1041,23 @@ void net_parse_command(void) {
                 net_skip_bytes(4);
                 break;
                 
-            case svc_updateentertime:
             case svc_updatestatlong:
                 net_skip_bytes(5);
                 break;
-                
-            case svc_temp_entity:
-                net_skip_bytes(7);
+
+            // Armor and blood taken, and where from
+            case svc_damage:
+                net_skip_bytes(8);
+                break;
+
+            case svc_spawnstaticsound:
+            case svc_intermission:
+                net_skip_bytes(9);
                 break;
                 
             default:
                 printf("Received unimplemented server message: %d\n", cmd);
+                flight_note("unimplemented server message");
                 net_skip_message();
                 read_msg = false;
                 break;
@@ -609,12 +1079,12 @@ int net_console_execute(char *cmd_str) {
     
     if (!strcmp(parser_argv(0), "cmd")) {
         // Send command to the server
-        net_write_integer(&netchan.message, clc_stringcmd, 1);
-        buf_write_string(&netchan.message, parser_args());
+        netchan_stringcmd(&netchan, pri_command, parser_args());
         return 1;
     } else if (!strcmp(parser_argv(0), "changing")) {
         // This will force reconnect on map change
-        con_state = connected; 
+        con_set_state(connected);
+        net_reconnect_begin();
         return 1;
     } else if (!strcmp(parser_argv(0), "reconnect")) {
         // Reconnect request
@@ -638,12 +1108,12 @@ int net_console_execute(char *cmd_str) {
     }
     else {
         if (cmd_str[0]) {
+            char fwd_cmd[MAX_STRING_CHARS];
+
             // Unknown commands are forwarded back to the server.
             printf("Unknown command '%s', forwarding to server.\n", parser_argv(0));
-            net_write_integer(&netchan.message, clc_stringcmd, 1);
-            buf_write_string(&netchan.message, parser_argv(0));
-            buf_write_string(&netchan.message, " ");
-            buf_write_string(&netchan.message, parser_args());
+            snprintf(fwd_cmd, sizeof (fwd_cmd), "%s %s", parser_argv(0), parser_args());
+            netchan_stringcmd(&netchan, pri_command, fwd_cmd);
         }
     }
     return 0;
@@ -659,8 +1129,10 @@ Executes commands that were stuffed to client console by the server
 void exec_stufftext(char *stuff_cmd) {
     char *cur_char = stuff_cmd;
     int cmd_begin_ptr = 0;
+    // Taken once, the commands are split by overwriting separators with 0
+    int len = strlen(stuff_cmd);
 
-    while (cur_char - stuff_cmd < strlen(stuff_cmd)) {
+    while (cur_char - stuff_cmd < len) {
         // Stop on newline, ";" or when out of characters
         for (; *cur_char && (*cur_char != '\n' && *cur_char != ';'); cur_char++);
         // Mark as end of command
@@ -677,18 +1149,21 @@ void exec_stufftext(char *stuff_cmd) {
 /*
 ==============
 exec_updateuserinfo
-Updates userinfo according to a full userinfo string received from server
+Updates a player on the scoreboard according to a full userinfo string
+received from server. The bot's own userinfo is what it sends, so its
+entry doesn't replace userinfo_root.
 ==============
  */
 void exec_updateuserinfo(void) {
-    net_skip_bytes(1);
+    int slot, user_id;
+
+    slot = net_read_bytes(1);
+    user_id = net_read_bytes(4);
     // Not used for anything at the moment, but stored anyway.
-    qw.user_id = net_read_bytes(4);
+    if (slot == qw.player_num)
+        qw.user_id = user_id;
 
-    // Clear the tree but keep the root
-    infostring_clear(userinfo_root, false);
-    // Construct a new tree from the received string
-    infostring_from_string(userinfo_root, net_read_string(false));
+    scoreboard_userinfo(slot, user_id, net_read_string(false));
 }
 
 /*
@@ -698,18 +1173,33 @@ Processes a serverdata packet that is received when connecting
 ==================
  */
 void exec_serverdata(void) {
-    char temp_str[100] = "";
+    char temp_str[100] = "", fragfile[MAX_OSPATH];
     int proto_ver;
 
     // Clear message
     buf_clear(&netchan.message);
+    netchan_says_sent(&netchan, false);
+    // Entity frames from the previous level are gone
+    qw.valid_sequence = 0;
+    entities_clear();
+    // A new map means different traffic, rate control may go lower again
+    qw.rate_floor = 0;
+    // Don't stay quiet if the end of a filtered block never came
+    filter_reset();
+    // The last summary of the previous map and the flood notices still due
+    // go out while its players are on the scoreboard, before the new map is
+    // announced
+    summary_flush();
+    flood_flush();
+    // The server sends every player again
+    scoreboard_clear();
 
     // Parse protocol version number
     proto_ver = net_read_bytes(4);
     if (proto_ver != QW_PROTOCOL_VERSION) {
         snprintf(temp_str, sizeof(temp_str), "Server returned protocol version %i, not %i. Aborting.\n", proto_ver, QW_PROTOCOL_VERSION);
         qw_to_irc_print(temp_str, color_statusmessage);
-        pthread_mutex_lock(&qw_mutex);
+        qw_mutex_lock();
         qw_running = false;
         pthread_mutex_unlock(&qw_mutex);
     }
@@ -726,21 +1216,32 @@ void exec_serverdata(void) {
     }
 
     // Get the full level name
-    strncpy(qw.map, net_read_string(false), sizeof(qw.map));
+    strncpy(qw.map, net_read_string(false), sizeof(qw.map) - 1);
+    qw.map[sizeof(qw.map) - 1] = 0;
 
     // Movevars can be ignored
     net_skip_bytes(40);
 
     // Print the name of the current map in IRC
     snprintf(temp_str, 14 + sizeof(qw.map), "Current map: %s\n", qw.map);
-    pthread_mutex_lock(&qw_mutex);
+    qw_mutex_lock();
     // Store in shared variable as well (for !qmap IRC command)
     strncpy(qw_map, qw.map, sizeof(qw_map));
+    // The print filter and the fragfile hold until the next map
+    qw.print_filter = print_filter_parse(qw_print_filter);
+    qw.frag_relay = qw_frag_relay;
+    summary.window = MAX(qw_summary_window, 0);
+    dedupe.ttl = MAX(qw_dedupe_ttl, 0) * 1000;
+    dedupe_limits_parse(qw_relay_limits);
+    flood.lines = MIN(MAX(qw_flood_lines, 0), MAX_FLOOD_LINES);
+    flood.window = MAX(qw_flood_window, 0) * 1000;
+    strcpy(fragfile, qw_fragfile);
     pthread_mutex_unlock(&qw_mutex);
+    frags_load(fragfile);
     qw_to_irc_print(temp_str, color_statusmessage);
 
     // Now waiting for downloads, etc
-    con_state = processing;
+    con_set_state(processing);
 }
 
 /*
@@ -750,23 +1251,31 @@ Updates serverinfo according to a a fullserverinfo string sent by server
 ==================
  */
 void exec_fullserverinfo(void) {
+    char status[32];
+
     if (parser_argc() != 2) {
         printf("Usage: fullserverinfo <complete info string>\n");
         return;
     }
 
-    // Clear tree but keep the root
-    infostring_clear(serverinfo_root, false);
-    // Construct new tree from the received string
-    infostring_from_string(serverinfo_root, parser_argv(1));
+    // Serverinfo often survives a reconnect unchanged, no need to rebuild then
+    if (strcmp(qw.serverinfo, parser_argv(1))) {
+        strncpy(qw.serverinfo, parser_argv(1), sizeof(qw.serverinfo) - 1);
+        // Clear tree but keep the root
+        infostring_clear(serverinfo_root, false);
+        // Construct new tree from the received string
+        infostring_from_string(serverinfo_root, parser_argv(1));
+        infostring_value(parser_argv(1), "status", status, sizeof (status));
+        summary_status(status);
+    }
 
     // Join the game if this is the first fullserverinfo we got
     if (con_state != active) {
-        char begin_cmd[10];
-        net_write_integer(&netchan.message, clc_stringcmd, 1);
+        char begin_cmd[20];
         snprintf(begin_cmd, sizeof(begin_cmd), "begin %d", qw.server_id);
-        net_write_string(&netchan.message, begin_cmd);
-        con_state = active;
+        netchan_stringcmd(&netchan, pri_signon, begin_cmd);
+        con_set_state(active);
+        net_reconnect_end();
         if (print_ver_info) {
             exec_chat("QuakeWorld eggdrop module %d.%d by aku.hasanen@kapsi.fi connected.", VER1, VER2, color_statusmessage);
             print_ver_info = false;
@@ -789,6 +1298,10 @@ void exec_packet(void) {
         return;
     }
 
+    // Nothing is sent during a replay, so don't resolve either
+    if (capture_replaying)
+        return;
+
     if (!string_to_netadr(parser_argv(1), &adr)) {
         printf("Error: Bad address. (exec_packet())\n");
         return;
@@ -799,24 +1312,79 @@ void exec_packet(void) {
     net_oob_transmit(adr, strlen(msg), msg);
 }
 
+/*
+==============
+exec_centerprint
+Relays a centerprint as one line. Centerprints are laid out for the middle
+of the screen, so runs of spaces and newlines become single spaces. An
+empty one only clears the screen.
+==============
+ */
+void exec_centerprint(char *text) {
+    char line[MAX_STRING_CHARS];
+    int n = 0;
+
+    for (; *text && n < sizeof (line) - 2; text++) {
+        if (*text == ' ' || *text == '\n' || *text == '\r') {
+            if (n && line[n - 1] != ' ')
+                line[n++] = ' ';
+        } else
+            line[n++] = *text;
+    }
+    if (n && line[n - 1] == ' ')
+        n--;
+    if (!n)
+        return;
+
+    line[n++] = '\n';
+    line[n] = 0;
+    qw_to_irc_print(line, color_centerprint);
+}
+
 /*
 ==============
 exec_setinfo
-Updates an infonode according to server's request
+Updates a userinfo key of a player according to server's request. Changes
+to the bot's own userinfo are kept for the next connect.
 ==============
  */
-void exec_setinfo(infonode_t* node) {
+void exec_setinfo(void) {
     char key[MAX_MSG_LEN];
     char value[MAX_MSG_LEN];
+    int slot;
 
-    net_skip_bytes(1);
+    slot = net_read_bytes(1);
 
     strncpy(key, net_read_string(false), sizeof (key) - 1);
     key[sizeof (key) - 1] = 0;
     strncpy(value, net_read_string(false), sizeof (value) - 1);
-    key[sizeof (value) - 1] = 0;
+    value[sizeof (value) - 1] = 0;
 
-    infostring_update_node(node, key, value);
+    scoreboard_setinfo(slot, key, value);
+    if (slot == qw.player_num) {
+        infostring_update_node(userinfo_root, key, value);
+        qw.userinfo[0] = 0;
+    }
+}
+
+/*
+==============
+exec_serverinfo
+Updates a serverinfo key according to server's request
+==============
+ */
+void exec_serverinfo(void) {
+    char key[MAX_MSG_LEN];
+    char value[MAX_MSG_LEN];
+
+    strncpy(key, net_read_string(false), sizeof (key) - 1);
+    key[sizeof (key) - 1] = 0;
+    strncpy(value, net_read_string(false), sizeof (value) - 1);
+    value[sizeof (value) - 1] = 0;
+
+    infostring_update_node(serverinfo_root, key, value);
+    if (!strcmp(key, "status"))
+        summary_status(value);
 }
 
 /*
@@ -826,14 +1394,15 @@ Reconnects to the server due to server or user request
 =================
  */
 void net_reconnect(void) {
+    net_reconnect_begin();
+
     if (con_state == connected) {
         qw_to_irc_print("Reconnecting...\n", color_statusmessage);
-        net_write_integer(&netchan.message, clc_stringcmd, 1);
-        net_write_string(&netchan.message, "new");
+        netchan_stringcmd(&netchan, pri_signon, "new");
         return;
     }
 
-    pthread_mutex_lock(&qw_mutex);
+    qw_mutex_lock();
     if (!*qw_server) {
         pthread_mutex_unlock(&qw_mutex);
         qw_to_irc_print("No server to reconnect to...\n", color_statusmessage);
@@ -846,6 +1415,71 @@ void net_reconnect(void) {
     net_request_challenge();
 }
 
+/*
+=================
+net_reconnect_begin
+Marks the start of a reconnect for latency tracking
+=================
+ */
+void net_reconnect_begin(void) {
+    if (!qw.reconnect_start)
+        qw.reconnect_start = qw.realtime;
+}
+
+/*
+=================
+net_reconnect_end
+Records the duration of a finished reconnect, and ends the one reconnect
+allowed after a timeout
+=================
+ */
+void net_reconnect_end(void) {
+    int duration;
+
+    // Back in the game, so a later timeout gets its own reconnect
+    qw.timeout_reconnect = 0;
+    if (!qw.reconnect_start)
+        return;
+
+    duration = qw.realtime - qw.reconnect_start;
+    qw.reconnect_start = 0;
+
+    // Shared with the IRC side for status reports
+    qw_mutex_lock();
+    qw.reconnects++;
+    metric_add(metric_reconnects, 1);
+    qw.reconnect_last = duration;
+    qw.reconnect_max = MAX(qw.reconnect_max, duration);
+    qw.reconnect_total += duration;
+    pthread_mutex_unlock(&qw_mutex);
+}
+
+/*
+=================
+net_resolve_server
+Resolves the address of qw_server. The result is cached, so a reconnect
+to the same server doesn't need a new DNS lookup. Call with qw_mutex held.
+=================
+ */
+bool net_resolve_server(netadr_t *adr) {
+    if (!qw.server_adr.ip.as_int || strcmp(qw.server_name, qw_server)) {
+        if (!string_to_netadr(qw_server, &qw.server_adr)) {
+            memset(&qw.server_adr, 0, sizeof (qw.server_adr));
+            return false;
+        }
+        if (qw.server_adr.port == 0)
+            qw.server_adr.port = byteswap_short(qw_server_port);
+
+        strncpy(qw.server_name, qw_server, sizeof (qw.server_name) - 1);
+        // Challenge and userinfo were for the old server
+        qw.challenge = 0;
+        qw.userinfo[0] = 0;
+    }
+
+    *adr = qw.server_adr;
+    return true;
+}
+
 /*
 ==================
 exec_sound
@@ -863,6 +1497,45 @@ void exec_sound(void) {
     net_skip_bytes(7);
 }
 
+/*
+==================
+exec_temp_entity
+Skips the svc_temp_entity parameters, which depend on the type. Coordinates
+are shorts.
+==================
+ */
+void exec_temp_entity(void) {
+    switch (net_read_bytes(1)) {
+        case te_gunshot:
+        case te_blood:
+            net_skip_bytes(1 + 6);
+            break;
+
+        case te_lightning1:
+        case te_lightning2:
+        case te_lightning3:
+            net_skip_bytes(2 + 6 + 6);
+            break;
+
+        case te_spike:
+        case te_superspike:
+        case te_explosion:
+        case te_tarexplosion:
+        case te_wizspike:
+        case te_knightspike:
+        case te_lavasplash:
+        case te_teleport:
+        case te_lightningblood:
+            net_skip_bytes(6);
+            break;
+
+        // The rest of the datagram can't be found, the client gives up too
+        default:
+            net_read_err = true;
+            break;
+    }
+}
+
 /*
 ==================
 net_request_connection
@@ -873,31 +1546,29 @@ connection-oriented communication via netchan.
 void net_request_connection(void) {
     netadr_t adr;
     char data[256];
-    char userinfo[MAX_INFO_STRING] = "";
 
     if (con_state != disconnected)
         return;
 
-    pthread_mutex_lock(&qw_mutex);
-    if (!string_to_netadr(qw_server, &adr)) {
+    qw_mutex_lock();
+    if (!net_resolve_server(&adr)) {
         printf("Bad server address!\n");
         qw.connect_time = -1;
         pthread_mutex_unlock(&qw_mutex);
         return;
     }
-
-    if (adr.port == 0)
-        adr.port = byteswap_short(qw_server_port);
-
     pthread_mutex_unlock(&qw_mutex);
 
     qw.connect_time = get_time();
 
-    infostring_update_node(userinfo_root, "*ip", netadr_to_string(adr));
-    infostring_print(userinfo_root, userinfo);
+    // Userinfo is only serialized again if it has changed
+    if (!qw.userinfo[0]) {
+        infostring_update_node(userinfo_root, "*ip", netadr_to_string(adr));
+        infostring_print(userinfo_root, qw.userinfo, sizeof (qw.userinfo));
+    }
 
     snprintf(data, sizeof(data), "connect %i %i %i \"%s\"\n", QW_PROTOCOL_VERSION, 
-            qw.qport, qw.challenge, userinfo);
+            qw.qport, qw.challenge, qw.userinfo);
     net_oob_transmit(adr, strlen(data), data);
 }
 
@@ -910,34 +1581,39 @@ Starts the connecting process by asking for a challenge number
 void net_request_challenge(void) {
     char irc_msg[64];
     netadr_t adr;
+    bool retry = qw.connect_time > 0;
 
     if (qw.connect_time == -1)
         return;
     if (con_state != disconnected)
         return;
-    if (qw.connect_time && qw.realtime - qw.connect_time < 5.0)
+    if (retry && qw.realtime - qw.connect_time < CONNECT_RETRY)
         return;
 
-    pthread_mutex_lock(&qw_mutex);
-    if (!string_to_netadr(qw_server, &adr)) {
+    qw_mutex_lock();
+    if (!net_resolve_server(&adr)) {
         printf("Error: Bad server address. (net_connect())\n");
         qw.connect_time = -1;
         pthread_mutex_unlock(&qw_mutex);
         return;
     }
 
-    if (adr.port == 0)
-        adr.port = byteswap_short(qw_server_port);
-
     // For retransmit requests
     qw.connect_time = get_time(); 
 
     snprintf(irc_msg, sizeof(irc_msg), "Connecting to %s...\n", qw_server);
     pthread_mutex_unlock(&qw_mutex);
 
-    qw_to_irc_print(irc_msg, color_statusmessage);
+    if (!retry)
+        qw_to_irc_print(irc_msg, color_statusmessage);
 
     net_oob_transmit(adr, 13, "getchallenge\n");
+
+    // If we've been connected to this server before, the old challenge is
+    // probably still valid. Try it right away instead of waiting a round trip
+    // for the new one, which is used if the server rejects the old.
+    if (qw.challenge)
+        net_request_connection();
 }
 
 /*
@@ -956,7 +1632,7 @@ void exec_rcon(char* cmd) {
     SHA1_Init(&qw_ctx);
     unsigned char hash[SHA_DIGEST_LENGTH];
 
-    pthread_mutex_lock(&qw_mutex);
+    qw_mutex_lock();
     if (!qw_rcon_password[0]) {
         pthread_mutex_unlock(&qw_mutex);
         qw_to_irc_print("You must set the tcl variable 'qw_rcon_password' before "
@@ -1022,10 +1698,12 @@ void net_disconnect(void) {
     
     if (con_state != disconnected) {
         byte drop_cmd[] = {clc_stringcmd, ' ', 'd', 'r', 'o', 'p'};
+        // Flush whatever was queued before leaving, e.g. a goodbye message
+        netchan_pack(&netchan);
         netchan_transmit(&netchan, 6, drop_cmd);
         netchan_transmit(&netchan, 6, drop_cmd);
         netchan_transmit(&netchan, 6, drop_cmd);
-        con_state = disconnected;
+        con_set_state(disconnected);
     }
 }
 
@@ -1053,9 +1731,9 @@ void net_oob_process(void) {
                 return;
             // Open network channel for connection-oriented transmission
             netchan_setup(&netchan, net_from, qw.qport);
-            net_write_integer(&netchan.message, clc_stringcmd, 1);
-            net_write_string(&netchan.message, "new");
-            con_state = connected;
+            qw.valid_sequence = 0;
+            netchan_stringcmd(&netchan, pri_signon, "new");
+            con_set_state(connected);
             qw_to_irc_print("Connected.\n", color_statusmessage);
             break;
         case CHALLENGE_RESPONSE:
@@ -1096,8 +1774,7 @@ void exec_chat(char *fmt, ...) {
     va_end(argptr);
 
     snprintf(msg2, 5 + strlen(msg), "say %s\n", msg);
-    net_write_integer(&netchan.message, clc_stringcmd, 1);
-    net_write_string(&netchan.message, msg2);
+    netchan_stringcmd(&netchan, pri_chat, msg2);
 
 }
 
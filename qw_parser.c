@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static int cmd_argc;
 static char *cmd_argv[MAX_STRING_TOKENS];
 static char cmd_args[MAX_STRING_CHARS];
+static char cmd_tokenized[MAX_STRING_CHARS + MAX_STRING_TOKENS]; // cmd_argv points here
 static char *cmd_null_string = "";
 char com_token[MAX_TOKEN_CHARS];
 
@@ -109,11 +110,12 @@ skipwhite:
             c = *data++;
             if ((c == '\"') || !c) {
                 com_token[len] = 0;
-                *data_p = data;
+                // Don't step past the end of an unterminated quote
+                *data_p = c ? data : data - 1;
                 return com_token;
             }
 
-            if (len < MAX_TOKEN_CHARS) {
+            if (len < MAX_TOKEN_CHARS - 1) {
                 com_token[len] = c;
                 len++;
             }
@@ -207,13 +209,11 @@ parser_tokenize
 ============
  */
 void parser_tokenize(char *text, bool macro_expand) {
-    int i;
-    char *com_token;
+    char *com_token, *text_out;
+    int len;
 
     // Clear the args from the last string
-    for (i = 0; i < cmd_argc; i++)
-        qw_eggdrop_free(cmd_argv[i]);
-
+    text_out = cmd_tokenized;
     cmd_argc = 0;
     cmd_args[0] = 0;
 
@@ -257,9 +257,12 @@ void parser_tokenize(char *text, bool macro_expand) {
         if (!text)
             return;
 
-        if (cmd_argc < MAX_STRING_TOKENS) {
-            cmd_argv[cmd_argc] = qw_eggdrop_malloc(strlen(com_token) + 1);
-            strcpy(cmd_argv[cmd_argc], com_token);
+        // Tokens that don't fit are dropped
+        len = strlen(com_token) + 1;
+        if (cmd_argc < MAX_STRING_TOKENS && text_out + len <= cmd_tokenized + sizeof (cmd_tokenized)) {
+            cmd_argv[cmd_argc] = text_out;
+            memcpy(text_out, com_token, len);
+            text_out += len;
             cmd_argc++;
         }
     }
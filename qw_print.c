@@ -0,0 +1,256 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "qw_common.h"
+
+// Table for decoding QuakeWorld-encoded chat messages
+char qw_char_tbl[256];
+
+// Relay classes as named in metrics and qwfilter
+const char *relay_class_names[relay_count] = {"status", "normal", "centerprint", "chat"};
+
+// svc_print levels as named in qw_print_filter
+const char *print_level_names[PRINT_LEVELS] = {"low", "medium", "high", "chat"};
+
+/*
+ * Formatting of QuakeWorld text for IRC. Sending the result is left to
+ * qw_irc_output(), so none of this depends on eggdrop.
+ */
+
+/*
+==============
+relay_class
+Tells what kind of line is printed, going by its svc_print level or, for
+other text, its color
+==============
+ */
+static relayclass_t relay_class(int color, int level) {
+    if (level >= 0)
+        return level == PRINT_CHAT ? relay_chat : relay_normal;
+    if (color == color_chattext)
+        return relay_chat;
+    if (color == color_centerprint)
+        return relay_centerprint;
+    if (color == color_statusmessage)
+        return relay_status;
+    return relay_normal;
+}
+
+/*
+==============
+print_filter_parse
+Turns a list of print level names into a bit for each level
+==============
+ */
+int print_filter_parse(char *names) {
+    char list[64], *name, *save;
+    int i, filter = 0;
+
+    strncpy(list, names, sizeof (list) - 1);
+    list[sizeof (list) - 1] = 0;
+    for (name = strtok_r(list, " ,", &save); name; name = strtok_r(NULL, " ,", &save)) {
+        for (i = 0; i < PRINT_LEVELS; i++) {
+            if (!strcasecmp(name, print_level_names[i]))
+                break;
+        }
+        if (i == PRINT_LEVELS)
+            printf("Error: Unknown print level '%s'. (print_filter_parse())\n", name);
+        else
+            filter |= 1 << i;
+    }
+    return filter;
+}
+
+/*
+==============
+relay_color
+Returns the IRC color lines of a relay class are printed in
+==============
+ */
+static int relay_color(relayclass_t class) {
+    if (class == relay_chat)
+        return color_chattext;
+    if (class == relay_centerprint)
+        return color_centerprint;
+    if (class == relay_status)
+        return color_statusmessage;
+    return color_normaltext;
+}
+
+/*
+==============
+relay_summarized
+Tells if a complete line of svc_print text is left out of the relay.
+Obituaries become kill events, and with summaries on they and pickups are
+only counted.
+==============
+ */
+static bool relay_summarized(char *line, int level) {
+    if (level == PRINT_MEDIUM && frags_line(line))
+        return summary_active() || !qw.frag_relay;
+    return level == PRINT_LOW && summary_pickup();
+}
+
+/*
+==============
+qw_print
+Handles printing incoming text from QuakeWorld in IRC. "level" is the
+svc_print level, or -1 for other text.
+==============
+ */
+static void qw_print(char* msg, int color, int level) {
+    static char msg_buffer[MAX_PRINT_MSG];
+    static uint64_t msg_stamp;              // Receive time of the first part of msg_buffer
+    int phase = prof_enter(prof_output);
+    int mark = arena_mark();
+    relayclass_t class;
+    
+    if (msg[0]) {
+        char* irc_msg = arena_alloc(strlen(msg) + 1);
+        strncpy(irc_msg, msg, strlen(msg) + 1);
+        // Remove leading newlines
+        if (irc_msg[0] == '\n') {
+            memmove(irc_msg, irc_msg + 1, strlen(irc_msg));
+        }
+
+        // Get rid of QuakeWorld's character encoding
+        qw_cleantext(irc_msg);
+
+        // Check if the string begins with the bot's nick. If so, remove.
+        char* bot_say_prefix = arena_alloc(strlen(qw_name) + 3);
+        snprintf(bot_say_prefix, strlen(qw_name) + 3, "%s: ", qw_name);
+        if (strnstr(irc_msg, strlen(bot_say_prefix), bot_say_prefix) != NULL) {
+            // Move the terminating 0 as well
+            memmove(irc_msg, irc_msg + strlen(bot_say_prefix), strlen(irc_msg) - strlen(bot_say_prefix) + 1);
+        }
+
+        // Append to buffer, a line that never ends is cut short
+        if (!msg_buffer[0])
+            msg_stamp = net_recv_stamp;
+        strncat(msg_buffer, irc_msg, sizeof (msg_buffer) - strlen(msg_buffer) - 1);
+        // Print only if there's a new line, or if no more text fits. The
+        // filter rules see whole lines, and may hide or reroute them.
+        // Obituaries and pickups may only be summed up, flooding players
+        // are held back, and server text seen a moment ago isn't repeated.
+        if (strnstr(msg_buffer, strlen(msg_buffer), "\n") != NULL || strlen(msg_buffer) == sizeof (msg_buffer) - 1) {
+            class = relay_class(color, level);
+            if (!relay_summarized(msg_buffer, level) && (level != PRINT_CHAT || flood_line(msg_buffer))
+                    && filter_line(msg_buffer, &class)
+                    && dedupe_line(msg_buffer, class, level)) {
+                if (class != relay_class(color, level))
+                    color = relay_color(class);
+                if (capture_replaying) {
+                    char line[MAX_PRINT_MSG + 64];
+                    snprintf(line, sizeof (line), "PRIVMSG %s :\003%d%s", qw_channel, color, msg_buffer);
+                    capture_replay_output(line);
+                } else {
+                    qw_irc_output(color, msg_buffer);
+                    scrollback_add(class, msg_buffer);
+                }
+                metric_add(metric_relayed + class, 1);
+                latency_record(&latency.relay, msg_stamp);
+            }
+            msg_buffer[0] = 0;
+        }
+    }
+    arena_release(mark);
+    prof_enter(phase);
+}
+
+/*
+==============
+qw_to_irc_print
+Prints text that didn't come with svc_print in IRC
+==============
+ */
+void qw_to_irc_print(char* msg, int color) {
+    qw_print(msg, color, -1);
+}
+
+/*
+==============
+qw_to_irc_print_level
+Prints a line of svc_print text in IRC
+==============
+ */
+void qw_to_irc_print_level(char *msg, int level) {
+    qw_print(msg, color_chattext, level);
+}
+
+/*
+====================
+qw_cleantext_init
+Initializes QuakeWorld character encoding table.
+This code is from the mvdsv project.
+====================
+ */
+void qw_cleantext_init(void) {
+    int i;
+
+    for (i = 0; i < 32; i++)
+        qw_char_tbl[i] = qw_char_tbl[i + 128] = '#';
+    for (i = 32; i < 128; i++)
+        qw_char_tbl[i] = qw_char_tbl[i + 128] = i;
+
+    // Special cases
+    qw_char_tbl[10] = 10;
+    qw_char_tbl[13] = 13;
+
+    // Dot
+    qw_char_tbl[5] = qw_char_tbl[14] = qw_char_tbl[15] = qw_char_tbl[28] = qw_char_tbl[46] = '.';
+    qw_char_tbl[5 + 128] = qw_char_tbl[14 + 128] = qw_char_tbl[15 + 128] = qw_char_tbl[28 + 128] = qw_char_tbl[46 + 128] = '.';
+
+    // Numbers
+    for (i = 18; i < 28; i++)
+        qw_char_tbl[i] = qw_char_tbl[i + 128] = i + 30;
+
+    // Brackets
+    qw_char_tbl[16] = qw_char_tbl[16 + 128] = '[';
+    qw_char_tbl[17] = qw_char_tbl[17 + 128] = ']';
+
+    // Left arrow
+    qw_char_tbl[127] = '>';
+    // Right arrow
+    qw_char_tbl[141] = '<';
+
+    // '-'
+    qw_char_tbl[30] = qw_char_tbl[129] = qw_char_tbl[30 + 128] = '-';
+    qw_char_tbl[29] = qw_char_tbl[29 + 128] = qw_char_tbl[128] = '-';
+    qw_char_tbl[31] = qw_char_tbl[31 + 128] = qw_char_tbl[130] = '-';
+}
+
+/*
+==============
+qw_cleantext
+Gets rid of QuakeWorld's character encoding in order to display the text
+cleanly in IRC.
+==============
+ */
+void qw_cleantext(char *text) {
+    for (; *text; text++) {
+        *text = qw_char_tbl[(unsigned char)*text];
+        // Remove double newlines
+        if (*text == '\n') {
+            if (text + 1) {
+                if (*(text + 1) == '\n')
+                    *text = ' ';
+            }
+        }
+    }
+}
@@ -0,0 +1,278 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Player table kept up to date from svc_updateuserinfo, svc_setinfo,
+ * svc_updatefrags, svc_updateping, svc_updatepl and svc_updateentertime
+ */
+
+scoreboard_t scoreboard;
+scoreboard_t scoreboard_shared;
+
+/*
+==============
+scoreboard_clear
+Forgets all players. The server sends them all again after serverdata.
+==============
+ */
+void scoreboard_clear(void) {
+    int name_serial = scoreboard.name_serial;
+
+    memset(&scoreboard, 0, sizeof (scoreboard));
+    scoreboard.name_serial = name_serial + 1;
+    scoreboard.changed = true;
+}
+
+/*
+==============
+scoreboard_set_name
+Stores a player's name as sent and as shown in IRC
+==============
+ */
+static void scoreboard_set_name(int slot, char *name) {
+    snprintf(scoreboard.name[slot], sizeof (scoreboard.name[slot]), "%s", name);
+    strcpy(scoreboard.clean_name[slot], scoreboard.name[slot]);
+    qw_cleantext(scoreboard.clean_name[slot]);
+    scoreboard.name_serial++;
+}
+
+/*
+==============
+scoreboard_set_team
+Stores a player's team as shown in IRC
+==============
+ */
+static void scoreboard_set_team(int slot, char *team) {
+    snprintf(scoreboard.team[slot], sizeof (scoreboard.team[slot]), "%s", team);
+    qw_cleantext(scoreboard.team[slot]);
+}
+
+/*
+==============
+scoreboard_userinfo
+Replaces a player's details with a full userinfo string. An empty string
+means the slot was freed.
+==============
+ */
+void scoreboard_userinfo(int slot, int user_id, char *info) {
+    char name[MAX_SCOREBOARDNAME], team[MAX_TEAMNAME], value[64];
+
+    if (slot < 0 || slot >= MAX_CLIENTS)
+        return;
+
+    scoreboard.changed = true;
+    scoreboard.user_id[slot] = user_id;
+    if (!info[0]) {
+        scoreboard.active[slot] = false;
+        scoreboard.name_serial++;
+        return;
+    }
+
+    // A new player starts from zero, someone changing their info doesn't
+    if (!scoreboard.active[slot]) {
+        scoreboard.frags[slot] = scoreboard.ping[slot] = scoreboard.pl[slot] = 0;
+        scoreboard.entertime[slot] = qw.realtime;
+    }
+    scoreboard.active[slot] = true;
+
+    // Read no more than the fields hold
+    infostring_value(info, "name", name, sizeof (name));
+    scoreboard_set_name(slot, name);
+    infostring_value(info, "team", team, sizeof (team));
+    scoreboard_set_team(slot, team);
+    scoreboard.spectator[slot] = infostring_value(info, "*spectator", value, sizeof (value))
+            && atoi(value);
+}
+
+/*
+==============
+scoreboard_setinfo
+Updates a single userinfo key of a player
+==============
+ */
+void scoreboard_setinfo(int slot, char *key, char *value) {
+    if (slot < 0 || slot >= MAX_CLIENTS)
+        return;
+
+    scoreboard.changed = true;
+    if (!strcmp(key, "name"))
+        scoreboard_set_name(slot, value);
+    else if (!strcmp(key, "team"))
+        scoreboard_set_team(slot, value);
+    else if (!strcmp(key, "*spectator"))
+        scoreboard.spectator[slot] = atoi(value);
+}
+
+/*
+==============
+scoreboard_publish
+Copies the scoreboard for the IRC side if it changed. Call with qw_mutex held.
+==============
+ */
+void scoreboard_publish(void) {
+    if (!scoreboard.changed)
+        return;
+
+    scoreboard.changed = false;
+    memcpy(&scoreboard_shared, &scoreboard, sizeof (scoreboard));
+}
+
+/*
+==============
+scoreboard_sort
+Fills order with the slots of players in the game, most frags first.
+Returns the number of players.
+==============
+ */
+static int scoreboard_sort(scoreboard_t *sb, int *order) {
+    int i, j, count = 0;
+
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        if (!sb->active[i] || sb->spectator[i])
+            continue;
+        // Insertion sort, there are at most MAX_CLIENTS
+        for (j = count++; j > 0 && sb->frags[order[j - 1]] < sb->frags[i]; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    return count;
+}
+
+/*
+==============
+scoreboard_players
+Formats a line listing the players with their team, frags and ping,
+followed by the spectators
+==============
+ */
+void scoreboard_players(scoreboard_t *sb, char *line, int size) {
+    int order[MAX_CLIENTS], count, i, n, spectators = 0;
+
+    count = scoreboard_sort(sb, order);
+    n = snprintf(line, size, "Players (%d):", count);
+    for (i = 0; i < count && n < size; i++) {
+        n += snprintf(line + n, size - n, "%s %s", i ? "," : "", sb->clean_name[order[i]]);
+        if (sb->team[order[i]][0] && n < size)
+            n += snprintf(line + n, size - n, " [%s]", sb->team[order[i]]);
+        if (n < size)
+            n += snprintf(line + n, size - n, " %d frags %d ms", sb->frags[order[i]], sb->ping[order[i]]);
+    }
+    if (!count && n < size)
+        n += snprintf(line + n, size - n, " none");
+
+    for (i = 0; i < MAX_CLIENTS && n < size; i++) {
+        if (!sb->active[i] || !sb->spectator[i])
+            continue;
+        n += snprintf(line + n, size - n, "%s %s", spectators++ ? "," : ". Spectators:",
+                sb->clean_name[i]);
+    }
+}
+
+/*
+==============
+scoreboard_team_totals
+Adds up the frags of each team, fills teams with a player slot of each
+team and totals with the team's frags, highest first. Returns the number
+of teams, or 0 if this isn't a team game.
+==============
+ */
+static int scoreboard_team_totals(scoreboard_t *sb, int *order, int count, int *teams, int *totals) {
+    int team_count = 0, i, j, t;
+
+    for (i = 0; i < count; i++) {
+        if (!sb->team[order[i]][0])
+            break;
+        for (t = 0; t < team_count && strcmp(sb->team[teams[t]], sb->team[order[i]]); t++);
+        if (t == team_count) {
+            teams[team_count] = order[i];
+            totals[team_count++] = 0;
+        }
+        totals[t] += sb->frags[order[i]];
+    }
+
+    // Everyone needs a team for a team score to make sense
+    if (i < count || team_count < 2)
+        return 0;
+
+    for (i = 0; i < team_count; i++)
+        for (j = i; j > 0 && totals[j - 1] < totals[j]; j--) {
+            t = totals[j], totals[j] = totals[j - 1], totals[j - 1] = t;
+            t = teams[j], teams[j] = teams[j - 1], teams[j - 1] = t;
+        }
+    return team_count;
+}
+
+/*
+==============
+scoreboard_teams
+Formats the team totals, e.g. "blue 45 - red 38". Returns the length of
+the text, 0 if this isn't a team game.
+==============
+ */
+int scoreboard_teams(scoreboard_t *sb, char *line, int size) {
+    int order[MAX_CLIENTS], teams[MAX_CLIENTS], totals[MAX_CLIENTS];
+    int team_count, t, n = 0;
+
+    team_count = scoreboard_team_totals(sb, order, scoreboard_sort(sb, order), teams, totals);
+    line[0] = 0;
+    for (t = 0; t < team_count && n < size; t++)
+        n += snprintf(line + n, size - n, "%s%s %d", t ? " - " : "", sb->team[teams[t]], totals[t]);
+    return MIN(n, size - 1);
+}
+
+/*
+==============
+scoreboard_scores
+Formats a line with the score. When players have teams, team totals come
+first and players are listed under their team.
+==============
+ */
+void scoreboard_scores(scoreboard_t *sb, char *line, int size) {
+    int order[MAX_CLIENTS], teams[MAX_CLIENTS], totals[MAX_CLIENTS];
+    int count, team_count, i, j, t, n;
+
+    count = scoreboard_sort(sb, order);
+    if (!count) {
+        snprintf(line, size, "No players in the game.");
+        return;
+    }
+
+    // Team totals, ordered by score like the players
+    if (!(team_count = scoreboard_team_totals(sb, order, count, teams, totals))) {
+        n = snprintf(line, size, "Score:");
+        for (i = 0; i < count && n < size; i++)
+            n += snprintf(line + n, size - n, "%s %s %d", i ? "," : "",
+                    sb->clean_name[order[i]], sb->frags[order[i]]);
+        return;
+    }
+
+    n = snprintf(line, size, "Score:");
+    for (t = 0; t < team_count && n < size; t++) {
+        n += snprintf(line + n, size - n, "%s %s %d (", t ? " |" : "", sb->team[teams[t]], totals[t]);
+        for (i = j = 0; i < count && n < size; i++)
+            if (!strcmp(sb->team[order[i]], sb->team[teams[t]]))
+                n += snprintf(line + n, size - n, "%s%s %d", j++ ? ", " : "",
+                        sb->clean_name[order[i]], sb->frags[order[i]]);
+        if (n < size)
+            n += snprintf(line + n, size - n, ")");
+    }
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * The latest lines relayed to IRC, for !qlast
+ */
+
+scrollback_t scrollback;
+scrollback_t scrollback_shared;
+
+/*
+==============
+scrollback_clear
+Forgets the lines of the previous session, the IRC side's copy too. Call
+with qw_mutex held.
+==============
+ */
+void scrollback_clear(void) {
+    scrollback.count = 0;
+    scrollback_shared.count = 0;
+}
+
+/*
+==============
+scrollback_add
+Keeps a line that was relayed, on one line and without trailing spaces.
+The oldest line is overwritten.
+==============
+ */
+void scrollback_add(relayclass_t class, char *text) {
+    scrollentry_t *entry = &scrollback.entry[scrollback.count % SCROLLBACK_SIZE];
+    int len = 0;
+
+    for (; *text && len < SCROLLBACK_TEXT - 1; text++)
+        entry->text[len++] = *text == '\n' || *text == '\r' ? ' ' : *text;
+    while (len && entry->text[len - 1] == ' ')
+        len--;
+    if (!len)
+        return;
+    entry->text[len] = 0;
+    entry->class = class;
+    entry->time = time(NULL);
+    scrollback.count++;
+}
+
+/*
+==============
+scrollback_publish
+Copies the lines relayed since the last call for the IRC side. Call with
+qw_mutex held.
+==============
+ */
+void scrollback_publish(void) {
+    int i;
+
+    for (i = MAX(scrollback_shared.count, scrollback.count - SCROLLBACK_SIZE); i < scrollback.count; i++)
+        scrollback_shared.entry[i % SCROLLBACK_SIZE] = scrollback.entry[i % SCROLLBACK_SIZE];
+    scrollback_shared.count = scrollback.count;
+}
+
+/*
+==============
+scrollback_latest
+Finds the latest lines of a class, or of any class if class is
+relay_count. Fills in at most "max" ring indexes, oldest first, and
+returns how many were found.
+==============
+ */
+int scrollback_latest(scrollback_t *sb, relayclass_t class, int *index, int max) {
+    int i, found = 0;
+
+    for (i = sb->count - 1; i >= MAX(sb->count - SCROLLBACK_SIZE, 0) && found < max; i--) {
+        if (class == relay_count || sb->entry[i % SCROLLBACK_SIZE].class == class)
+            index[found++] = i % SCROLLBACK_SIZE;
+    }
+    // Oldest first
+    for (i = 0; i < found / 2; i++) {
+        int swap = index[i];
+        index[i] = index[found - 1 - i];
+        index[found - 1 - i] = swap;
+    }
+    return found;
+}
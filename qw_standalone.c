@@ -0,0 +1,81 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+#include "qw_common.h"
+
+/*
+ * Stand-ins for the parts of the module that normally come from eggdrop
+ * (qwirc.c and qwirc.h), so that the QuakeWorld side can be built and
+ * exercised on its own, e.g. by the benchmarks.
+ */
+
+// TCL variables with the defaults from qwirc.tcl
+char qw_name[25] = "qwirc";
+char qw_server[100], qw_password[100], qw_rcon_password[100];
+char qw_capture_file[MAX_OSPATH];
+char qw_print_filter[64];
+char qw_fragfile[MAX_OSPATH];
+int qw_frag_relay = 1;
+int qw_summary_window;
+int qw_dedupe_ttl = 600;
+int qw_flood_lines = 4, qw_flood_window = 8;
+char qw_relay_limits[64] = "centerprint 3000 2";
+char qw_map[40];
+char qw_channel[25] = "#qwirc";
+int qw_server_port = 27500, qw_encrypt_rcon = 1, qw_rate = 2500;
+int qw_topcolor, qw_bottomcolor, qw_msgmode;
+int qw_chat_interval = 1500, qw_chat_burst = 3;
+int color_statusmessage = 9, color_centerprint = 6, color_chattext = 15, color_normaltext = 16;
+
+long qw_maxrss;
+pthread_mutex_t qw_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+long standalone_allocs;                 // Number of allocations made
+long standalone_output;                 // Bytes of text sent to "IRC"
+
+/*
+==============
+qw_eggdrop_malloc
+Allocates memory with malloc, counting allocations
+==============
+ */
+void* qw_eggdrop_malloc(int size) {
+    standalone_allocs++;
+    return malloc(size);
+}
+
+/*
+==============
+qw_eggdrop_free
+Frees memory allocated with qw_eggdrop_malloc
+==============
+ */
+void qw_eggdrop_free(void* pointer) {
+    free(pointer);
+}
+
+/*
+==============
+qw_irc_output
+Discards a line meant for IRC, only counting its length
+==============
+ */
+void qw_irc_output(int color, char *text) {
+    standalone_output += strlen(text);
+}
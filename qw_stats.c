@@ -0,0 +1,286 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Statistics: latency histograms and the frame profiler
+ */
+
+latency_t latency;
+latency_t latency_shared;
+profiler_t profiler;
+
+static __thread int prof_phase = -1;    // Current phase, -1 if this thread isn't profiled
+static __thread uint64_t prof_since;    // When the current phase was entered
+static uint64_t prof_window_start;      // When profiler.current began
+static uint64_t prof_frame_start;       // When the current frame woke up
+
+/*
+==============
+latency_now
+Returns the wall clock time in nanoseconds. The same clock is used by the
+kernel's SO_TIMESTAMPNS receive timestamps.
+==============
+ */
+uint64_t latency_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+==============
+latency_record
+Records the time from stamp until now. Replays run on a virtual clock, so
+they aren't recorded.
+==============
+ */
+void latency_record(histogram_t *h, uint64_t stamp) {
+    uint64_t now;
+
+    if (!stamp || capture_replaying)
+        return;
+
+    now = latency_now();
+    histogram_add(h, now > stamp ? MIN((now - stamp) / 1000, UINT32_MAX) : 0);
+    latency.changed = true;
+}
+
+/*
+==============
+latency_clear
+Forgets the latencies of the previous session
+==============
+ */
+void latency_clear(void) {
+    memset(&latency, 0, sizeof (latency));
+    latency.changed = true;
+}
+
+/*
+==============
+latency_publish
+Copies the histograms for the IRC side if there are new samples. Call
+with qw_mutex held.
+==============
+ */
+void latency_publish(void) {
+    if (!latency.changed)
+        return;
+
+    latency.changed = false;
+    memcpy(&latency_shared, &latency, sizeof (latency));
+}
+
+/*
+==============
+histogram_bucket
+Returns the bucket a value falls in
+==============
+ */
+static int histogram_bucket(uint32_t value) {
+    int msb;
+
+    if (value < HIST_SUB)
+        return value;
+
+    msb = 31 - __builtin_clz(value);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + ((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/*
+==============
+histogram_bucket_max
+Returns the highest value that falls in a bucket
+==============
+ */
+static uint32_t histogram_bucket_max(int bucket) {
+    int shift = bucket / HIST_SUB - 1;
+
+    if (shift < 0)
+        return bucket;
+
+    return (((uint64_t) (HIST_SUB | (bucket % HIST_SUB)) + 1) << shift) - 1;
+}
+
+/*
+==============
+histogram_add
+Records a value
+==============
+ */
+void histogram_add(histogram_t *h, uint32_t value) {
+    h->count[histogram_bucket(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+/*
+==============
+histogram_count_below
+Returns how many recorded values were below value. Exact when value is a
+bucket boundary, such as a power of two.
+==============
+ */
+uint32_t histogram_count_below(histogram_t *h, uint32_t value) {
+    uint32_t count = 0;
+    int i, last = histogram_bucket(value);
+
+    for (i = 0; i < last; i++)
+        count += h->count[i];
+    return count;
+}
+
+/*
+==============
+histogram_percentile
+Returns the value below which the given percentage of recorded values
+fall, rounded up to the bucket boundary but never above the maximum
+==============
+ */
+uint32_t histogram_percentile(histogram_t *h, float percentile) {
+    uint32_t seen = 0, wanted;
+    int i;
+
+    if (!h->total)
+        return 0;
+
+    wanted = MAX(1, h->total * percentile / 100.0f + 0.5f);
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen >= wanted)
+            return MIN(histogram_bucket_max(i), h->max);
+    }
+
+    return h->max;
+}
+
+/*
+==============
+prof_clock
+Returns monotonic time in nanoseconds
+==============
+ */
+uint64_t prof_clock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+==============
+prof_start
+Starts profiling the calling thread, which should be the QuakeWorld thread
+==============
+ */
+void prof_start(void) {
+    memset(&profiler, 0, sizeof (profiler));
+    prof_since = prof_window_start = prof_frame_start = prof_clock();
+    prof_phase = prof_other;
+}
+
+/*
+==============
+prof_enter
+Switches to another phase. Returns the phase that was left, so that a
+nested phase can switch back to it. Does nothing in threads that aren't
+profiled.
+==============
+ */
+int prof_enter(int phase) {
+    profwindow_t *w = &profiler.current;
+    uint64_t now, spent;
+    int prev = prof_phase;
+
+    if (prev < 0 || phase < 0 || phase == prev)
+        return prev;
+
+    now = prof_clock();
+    spent = now - prof_since;
+    w->time[prev] += spent;
+    if (spent > w->max[prev])
+        w->max[prev] = spent;
+    w->calls[phase]++;
+
+    // A frame begins when the thread wakes up
+    if (prev == prof_idle)
+        prof_frame_start = now;
+
+    prof_since = now;
+    prof_phase = phase;
+    return prev;
+}
+
+/*
+==============
+prof_frame
+Ends a frame and rolls the window over when it's full. Call with qw_mutex
+held.
+==============
+ */
+void prof_frame(void) {
+    profwindow_t *w = &profiler.current, *t = &profiler.total;
+    uint64_t now;
+    int i;
+
+    if (prof_phase < 0)
+        return;
+
+    prof_enter(prof_other);
+    now = prof_since;
+    w->frames++;
+    if (now - prof_frame_start > w->frame_max)
+        w->frame_max = now - prof_frame_start;
+
+    if (now - prof_window_start < PROF_WINDOW * 1000000ULL)
+        return;
+
+    w->elapsed = now - prof_window_start;
+    for (i = 0; i < prof_count; i++) {
+        t->time[i] += w->time[i];
+        t->max[i] = MAX(t->max[i], w->max[i]);
+        t->calls[i] += w->calls[i];
+    }
+    t->frames += w->frames;
+    t->frame_max = MAX(t->frame_max, w->frame_max);
+    t->elapsed += w->elapsed;
+
+    profiler.last = *w;
+    memset(w, 0, sizeof (*w));
+    prof_window_start = now;
+}
+
+/*
+==============
+qw_mutex_lock
+Locks qw_mutex, counting the wait as its own phase
+==============
+ */
+void qw_mutex_lock(void) {
+    int phase = prof_enter(prof_mutex);
+
+    pthread_mutex_lock(&qw_mutex);
+    prof_enter(phase);
+}
@@ -0,0 +1,210 @@
+/*
+Copyright (C) 2014 aku.hasanen@kapsi.fi
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+
+#include "qw_common.h"
+
+/*
+ * Obituaries and pickups counted over a window and summed up in one line
+ */
+
+summary_t summary;
+
+/*
+==============
+summary_reset
+Starts a new window
+==============
+ */
+static void summary_reset(void) {
+    memset(summary.frags, 0, sizeof (summary.frags));
+    summary.kills = summary.pickups = 0;
+}
+
+/*
+==============
+summary_clear
+Forgets the window and the match state of the previous session
+==============
+ */
+void summary_clear(void) {
+    memset(&summary, 0, sizeof (summary));
+}
+
+/*
+==============
+summary_active
+Tells if obituaries and pickups are summed up instead of relayed
+==============
+ */
+bool summary_active(void) {
+    return summary.window > 0;
+}
+
+/*
+==============
+summary_status
+Follows the match state from the "status" serverinfo key. A window ends
+early when the state changes, except that what happened before the
+countdown is of no interest once it begins.
+==============
+ */
+void summary_status(char *status) {
+    matchstate_t state;
+
+    if (!status[0])
+        state = match_unknown;
+    else if (!strcasecmp(status, "Standby"))
+        state = match_prewar;
+    else if (!strcasecmp(status, "Countdown"))
+        state = match_countdown;
+    else
+        state = match_playing;
+
+    if (state == summary.state)
+        return;
+    if (state == match_countdown)
+        summary_reset();
+    else
+        summary_flush();
+    summary.state = state;
+}
+
+/*
+==============
+summary_open
+Starts the window's clock with its first event
+==============
+ */
+static void summary_open(void) {
+    if (!summary.kills && !summary.pickups)
+        summary.start = qw.realtime;
+}
+
+/*
+==============
+summary_kill
+Counts a kill event, scored the way the server scores it
+==============
+ */
+void summary_kill(killevent_t *event) {
+    if (!summary.window)
+        return;
+
+    summary_open();
+    summary.kills++;
+    if (event->kind == kill_frag && event->killer_slot >= 0)
+        summary.frags[event->killer_slot]++;
+    else if (event->kind == kill_teamkill && event->killer_slot >= 0)
+        summary.frags[event->killer_slot]--;
+    else if ((event->kind == kill_suicide || event->kind == kill_death) && event->victim_slot >= 0)
+        summary.frags[event->victim_slot]--;
+}
+
+/*
+==============
+summary_pickup
+Counts a pickup message. Returns false if summaries are off and the
+message is to be relayed.
+==============
+ */
+bool summary_pickup(void) {
+    if (!summary.window)
+        return false;
+
+    summary_open();
+    summary.pickups++;
+    return true;
+}
+
+/*
+==============
+summary_format
+Writes out the window, e.g. "[30s] blue 45 - red 38, 17 frags, top: Bob
+5, Alice 4". Prewar summaries only name the top player, and leave out the
+team score.
+==============
+ */
+static void summary_format(char *line, int size) {
+    int order[MAX_CLIENTS], count = 0, top, seconds, i, j, n;
+
+    seconds = (qw.realtime - summary.start + 500) / 1000;
+    if (seconds >= 60 && !(seconds % 60))
+        n = snprintf(line, size, "[%dm] ", seconds / 60);
+    else
+        n = snprintf(line, size, "[%ds] ", seconds);
+
+    if (summary.state == match_prewar)
+        n += snprintf(line + n, size - n, "prewar: ");
+    else if (n < size && (i = scoreboard_teams(&scoreboard, line + n, size - n)))
+        n += i + snprintf(line + n + i, size - n - i, ", ");
+
+    if (n < size)
+        n += snprintf(line + n, size - n, "%d frag%s", summary.kills, summary.kills == 1 ? "" : "s");
+    if (summary.pickups && n < size)
+        n += snprintf(line + n, size - n, ", %d pickup%s", summary.pickups, summary.pickups == 1 ? "" : "s");
+
+    // Players who gained most in the window, insertion sort as there are at most MAX_CLIENTS
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        if (!scoreboard.active[i] || summary.frags[i] <= 0)
+            continue;
+        for (j = count++; j > 0 && summary.frags[order[j - 1]] < summary.frags[i]; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    top = MIN(count, summary.state == match_prewar ? 1 : SUMMARY_TOP);
+    for (i = 0; i < top && n < size; i++)
+        n += snprintf(line + n, size - n, "%s%s %d", i ? ", " : ", top: ",
+                scoreboard.clean_name[order[i]], summary.frags[order[i]]);
+    if (n < size)
+        snprintf(line + n, size - n, "\n");
+}
+
+/*
+==============
+summary_flush
+Sends the line for the window so far, if anything happened in it, and
+starts a new one
+==============
+ */
+void summary_flush(void) {
+    char line[MAX_PRINT_MSG];
+
+    if (!summary.kills && !summary.pickups)
+        return;
+
+    summary_format(line, sizeof (line));
+    summary_reset();
+    qw_to_irc_print(line, color_normaltext);
+}
+
+/*
+==============
+summary_frame
+Ends the window once it has run its length, called every frame
+==============
+ */
+void summary_frame(void) {
+    int window = summary.window * 1000;
+
+    if (summary.state == match_prewar)
+        window *= SUMMARY_PREWAR_SCALE;
+    if ((summary.kills || summary.pickups) && qw.realtime - summary.start >= window)
+        summary_flush();
+}
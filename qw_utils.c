@@ -20,6 +20,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qw_common.h"
 
+int net_read_count;                     // Bytes read from net_message
+bool net_read_err;                      // Tried to read past the end of net_message?
+
+infonode_t* userinfo_root;              // Root node for userinfo "tree"
+infonode_t* serverinfo_root;            // Root node for serverinfo "tree"
+static slab_t infonode_slab = {sizeof (infonode_t), mem_infostring};
+
 /*
  * Network message writing and reading
 */
@@ -38,9 +45,6 @@ void net_write_integer(netbuf_t *sb, int c, int bytes) {
 
     for (i = 0; i < bytes; i++)
         buf[i] = (c >> (8 * i)) & 0xFF;
-
-    i++;
-    buf[i] = c >> (8 * (i - 1));
 }
 
 /*
@@ -89,7 +93,7 @@ int net_read_bytes(int bytes) {
 
     // Read and convert to little-endian by bit-shifting accordingly
     for (i = 0; i < bytes; i++)
-        buf += (net_message.data[net_read_count + i] << (8 * i));
+        buf += ((uint32_t) net_message.data[net_read_count + i] << (8 * i));
 
     net_read_count += bytes;
 
@@ -123,6 +127,18 @@ char* net_read_string(bool break_on_nl) {
     return str;
 }
 
+/*
+=============
+net_skip_string
+Skips a string in the network message buffer without copying it
+=============
+*/
+void net_skip_string(void) {
+    byte *end = memchr(net_message.data + net_read_count, 0, net_message.cur_size - net_read_count);
+
+    net_read_count = end ? end - net_message.data + 1 : net_message.cur_size;
+}
+
 /*
 =============
 net_skip_bytes
@@ -143,7 +159,7 @@ Skips an entire network message
 ==============
 */
 void net_skip_message() {
-    for (; net_read_count + 1 >= net_message.cur_size; net_read_count++);
+    net_read_count = net_message.cur_size;
 }
 
 /*
@@ -236,11 +252,13 @@ Also initializes serverinfo root node.
 void infostring_init(void) {
     infonode_t* cur_node;
     char tmp_str[64]; // Used to convert int values to strings
-    userinfo_root = (infonode_t*) qw_eggdrop_malloc(sizeof (infonode_t));
+    userinfo_root = (infonode_t*) slab_alloc(&infonode_slab);
     userinfo_root->next = NULL;
-    pthread_mutex_lock(&qw_mutex);
+    qw_mutex_lock();
 
-    snprintf(tmp_str, sizeof(tmp_str), "%d", qw_rate);
+    // Rate control starts over from the configured rate
+    qw.rate = qw_rate;
+    snprintf(tmp_str, sizeof(tmp_str), "%d", qw.rate);
     cur_node = infostring_add_node(userinfo_root, "rate", tmp_str);
 
     cur_node = infostring_add_node(cur_node, "name", qw_name);
@@ -261,7 +279,7 @@ void infostring_init(void) {
 
     pthread_mutex_unlock(&qw_mutex);
 
-    serverinfo_root = (infonode_t*) qw_eggdrop_malloc(sizeof (infonode_t));
+    serverinfo_root = (infonode_t*) slab_alloc(&infonode_slab);
     serverinfo_root->next = NULL;
 }
 
@@ -284,7 +302,7 @@ infonode_t* infostring_add_node(infonode_t* pos, char* key, char* val) {
     }
 
     // Allocate new node
-    pos->next = (struct infonode_t*) qw_eggdrop_malloc(sizeof (infonode_t));
+    pos->next = (struct infonode_t*) slab_alloc(&infonode_slab);
     pos = (infonode_t*) pos->next;
     strncpy(pos->key, key, strlen(key) + 1);
     strncpy(pos->value, val, strlen(val) + 1);
@@ -375,21 +393,57 @@ void infostring_clear(infonode_t* root, bool free_root) {
         // Store the address of the node after the next node, then delete next node
         while (tmp->next) {
             root->next = tmp->next;
-            qw_eggdrop_free(tmp);
+            slab_free(&infonode_slab, tmp);
             tmp = (infonode_t*) root->next;
         }
-        qw_eggdrop_free(tmp);
+        slab_free(&infonode_slab, tmp);
 
         root->next = NULL;
     }
     
     // Free the root node if requested. Normally only on disconnect.
     if (free_root) {
-        qw_eggdrop_free(root);
+        slab_free(&infonode_slab, root);
         root = NULL;
     }
 }
 
+/*
+=================
+infostring_value
+Finds the value of a key in an infostring without building nodes. Returns
+false if the key isn't there, value is then empty.
+=================
+*/
+bool infostring_value(char *info, char *key, char *value, int size) {
+    int key_len = strlen(key), len;
+    char *end;
+
+    value[0] = 0;
+    while (*info == '\\') {
+        info++;
+        end = strchr(info, '\\');
+        if (!end)
+            return false;
+
+        // Value runs up to the next key or the end
+        if (end - info == key_len && !strncmp(info, key, key_len)) {
+            info = end + 1;
+            end = strchr(info, '\\');
+            len = end ? end - info : (int) strlen(info);
+            len = MIN(len, size - 1);
+            memcpy(value, info, len);
+            value[len] = 0;
+            return true;
+        }
+
+        info = strchr(end + 1, '\\');
+        if (!info)
+            return false;
+    }
+    return false;
+}
+
 /*
 =================
 infostring_from_string
@@ -397,6 +451,7 @@ Creates infonodes from a infostring
 =================
 */
 void infostring_from_string(infonode_t* cur_node, char* info) {
+    infonode_t* new_node;
     char new_key[64];
     char new_val[64];
     char* cur_char;
@@ -420,10 +475,14 @@ void infostring_from_string(infonode_t* cur_node, char* info) {
         str_len = 0;
         cur_char = new_key;
         while (*info != '\\') {
-            if (!*info || str_len > 63)
+            if (!*info)
                 break;
-            *cur_char++ = *info++;
-            str_len++;
+            // Overlong keys are truncated
+            if (str_len < sizeof (new_key) - 1) {
+                *cur_char++ = *info;
+                str_len++;
+            }
+            info++;
         }
 
         // Skip key-value separator
@@ -434,24 +493,29 @@ void infostring_from_string(infonode_t* cur_node, char* info) {
         str_len = 0;
         cur_char = new_val;
         while (*info != '\\' && *info) {
-            if (!*info || str_len > 63)
-                break;
-            *cur_char++ = *info++;
-            str_len++;
+            if (str_len < sizeof (new_val) - 1) {
+                *cur_char++ = *info;
+                str_len++;
+            }
+            info++;
         }
 
-        // Create new infostring node
-        cur_node = infostring_add_node(cur_node, new_key, new_val);
+        // Create new infostring node, skipping pairs that aren't allowed
+        if ((new_node = infostring_add_node(cur_node, new_key, new_val)))
+            cur_node = new_node;
     }
 }
 
 /*
 =================
 infostring_print
-Prints infonode key-value pairs to a string
+Prints infonode key-value pairs to a string of the given size. Pairs that
+don't fit are left out.
 =================
 */
-void infostring_print(infonode_t* root, char* istr) {
+void infostring_print(infonode_t* root, char* istr, int size) {
+    int len = strlen(istr);
+
     if (!root) {
         printf("Error: Invalid node as argument for infostring_to_string()!\n");
         return;
@@ -462,10 +526,8 @@ void infostring_print(infonode_t* root, char* istr) {
 
     while (root) {
         // Write key-value pair
-        strncat(istr, "\\", 1);
-        strncat(istr, root->key, sizeof(root->key));
-        strncat(istr, "\\", 1);
-        strncat(istr, root->value, sizeof(root->value));
+        if (len + strlen(root->key) + strlen(root->value) + 2 < size)
+            len += sprintf(istr + len, "\\%s\\%s", root->key, root->value);
 
         root = (infonode_t*) root->next;
     }
@@ -501,6 +563,10 @@ int get_time(void) {
     struct timezone tzp;
     static int begin_time;
 
+    // Replays run on the clock of the capture
+    if (capture_replaying)
+        return qw.realtime;
+
     gettimeofday(&tp, &tzp);
 
     if (!begin_time) {
@@ -512,6 +578,28 @@ int get_time(void) {
     return qw.realtime;
 }
 
+/*
+==============
+tokenbucket_take
+Takes a token from a bucket that gains one token every interval ms and
+holds at most burst tokens. Returns false if the bucket is empty.
+==============
+*/
+bool tokenbucket_take(tokenbucket_t *tb, int interval, int burst, float now) {
+    if (interval > 0)
+        tb->tokens += (now - tb->last_fill) / interval;
+    else
+        tb->tokens = burst;
+    tb->tokens = MIN(tb->tokens, MAX(burst, 1));
+    tb->last_fill = now;
+
+    if (tb->tokens < 1)
+        return false;
+
+    tb->tokens--;
+    return true;
+}
+
 /*
 ==============
 byteswap_short
@@ -530,3 +618,114 @@ short byteswap_short(short number) {
     return (leftmost << 8) +rightmost; // Return swapped bytes as short
 }
 
+/*
+ * Move checksums
+ */
+
+// id's salt table. The server picks 4 bytes of it by sequence number.
+static byte sequence_crc_table[1024 + 4] = {
+    0x78, 0xd2, 0x94, 0xe3, 0x41, 0xec, 0xd6, 0xd5, 0xcb, 0xfc, 0xdb, 0x8a, 0x4b, 0xcc, 0x85, 0x01,
+    0x23, 0xd2, 0xe5, 0xf2, 0x29, 0xa7, 0x45, 0x94, 0x4a, 0x62, 0xe3, 0xa5, 0x6f, 0x3f, 0xe1, 0x7a,
+    0x64, 0xed, 0x5c, 0x99, 0x29, 0x87, 0xa8, 0x78, 0x59, 0x0d, 0xaa, 0x0f, 0x25, 0x0a, 0x5c, 0x58,
+    0xfb, 0x00, 0xa7, 0xa8, 0x8a, 0x1d, 0x86, 0x80, 0xc5, 0x1f, 0xd2, 0x28, 0x69, 0x71, 0x58, 0xc3,
+    0x51, 0x90, 0xe1, 0xf8, 0x6a, 0xf3, 0x8f, 0xb0, 0x68, 0xdf, 0x95, 0x40, 0x5c, 0xe4, 0x24, 0x6b,
+    0x29, 0x19, 0x71, 0x3f, 0x42, 0x63, 0x6c, 0x48, 0xe7, 0xad, 0xa8, 0x4b, 0x91, 0x8f, 0x42, 0x36,
+    0x34, 0xe7, 0x32, 0x55, 0x59, 0x2d, 0x36, 0x38, 0x38, 0x59, 0x9b, 0x08, 0x16, 0x4d, 0x8d, 0xf8,
+    0x0a, 0xa4, 0x52, 0x01, 0xbb, 0x52, 0xa9, 0xfd, 0x40, 0x18, 0x97, 0x37, 0xff, 0xc9, 0x82, 0x27,
+    0xb2, 0x64, 0x60, 0xce, 0x00, 0xd9, 0x04, 0xf0, 0x9e, 0x99, 0xbd, 0xce, 0x8f, 0x90, 0x4a, 0xdd,
+    0xe1, 0xec, 0x19, 0x14, 0xb1, 0xfb, 0xca, 0x1e, 0x98, 0x0f, 0xd4, 0xcb, 0x80, 0xd6, 0x05, 0x63,
+    0xfd, 0xa0, 0x74, 0xa6, 0x86, 0xf6, 0x19, 0x98, 0x76, 0x27, 0x68, 0xf7, 0xe9, 0x09, 0x9a, 0xf2,
+    0x2e, 0x42, 0xe1, 0xbe, 0x64, 0x48, 0x2a, 0x74, 0x30, 0xbb, 0x07, 0xcc, 0x1f, 0xd4, 0x91, 0x9d,
+    0xac, 0x55, 0x53, 0x25, 0xb9, 0x64, 0xf7, 0x58, 0x4c, 0x34, 0x16, 0xbc, 0xf6, 0x12, 0x2b, 0x65,
+    0x68, 0x25, 0x2e, 0x29, 0x1f, 0xbb, 0xb9, 0xee, 0x6d, 0x0c, 0x8e, 0xbb, 0xd2, 0x5f, 0x1d, 0x8f,
+    0xc1, 0x39, 0xf9, 0x8d, 0xc0, 0x39, 0x75, 0xcf, 0x25, 0x17, 0xbe, 0x96, 0xaf, 0x98, 0x9f, 0x5f,
+    0x65, 0x15, 0xc4, 0x62, 0xf8, 0x55, 0xfc, 0xab, 0x54, 0xcf, 0xdc, 0x14, 0x06, 0xc8, 0xfc, 0x42,
+    0xd3, 0xf0, 0xad, 0x10, 0x08, 0xcd, 0xd4, 0x11, 0xbb, 0xca, 0x67, 0xc6, 0x48, 0x5f, 0x9d, 0x59,
+    0xe3, 0xe8, 0x53, 0x67, 0x27, 0x2d, 0x34, 0x9e, 0x9e, 0x24, 0x29, 0xdb, 0x69, 0x99, 0x86, 0xf9,
+    0x20, 0xb5, 0xbb, 0x5b, 0xb0, 0xf9, 0xc3, 0x67, 0xad, 0x1c, 0x9c, 0xf7, 0xcc, 0xef, 0xce, 0x69,
+    0xe0, 0x26, 0x8f, 0x79, 0xbd, 0xca, 0x10, 0x17, 0xda, 0xa9, 0x88, 0x57, 0x9b, 0x15, 0x24, 0xba,
+    0x84, 0xd0, 0xeb, 0x4d, 0x14, 0xf5, 0xfc, 0xe6, 0x51, 0x6c, 0x6f, 0x64, 0x6b, 0x73, 0xec, 0x85,
+    0xf1, 0x6f, 0xe1, 0x67, 0x25, 0x10, 0x77, 0x32, 0x9e, 0x85, 0x6e, 0x69, 0xb1, 0x83, 0x00, 0xe4,
+    0x13, 0xa4, 0x45, 0x34, 0x3b, 0x40, 0xff, 0x41, 0x82, 0x89, 0x79, 0x57, 0xfd, 0xd2, 0x8e, 0xe8,
+    0xfc, 0x1d, 0x19, 0x21, 0x12, 0x00, 0xd7, 0x66, 0xe5, 0xc7, 0x10, 0x1d, 0xcb, 0x75, 0xe8, 0xfa,
+    0xb6, 0xee, 0x7b, 0x2f, 0x1a, 0x25, 0x24, 0xb9, 0x9f, 0x1d, 0x78, 0xfb, 0x84, 0xd0, 0x17, 0x05,
+    0x71, 0xb3, 0xc8, 0x18, 0xff, 0x62, 0xee, 0xed, 0x53, 0xab, 0x78, 0xd3, 0x65, 0x2d, 0xbb, 0xc7,
+    0xc1, 0xe7, 0x70, 0xa2, 0x43, 0x2c, 0x7c, 0xc7, 0x16, 0x04, 0xd2, 0x45, 0xd5, 0x6b, 0x6c, 0x7a,
+    0x5e, 0xa1, 0x50, 0x2e, 0x31, 0x5b, 0xcc, 0xe8, 0x65, 0x8b, 0x16, 0x85, 0xbf, 0x82, 0x83, 0xfb,
+    0xde, 0x9f, 0x36, 0x48, 0x32, 0x79, 0xd6, 0x9b, 0xfb, 0x52, 0x45, 0xbf, 0x43, 0xf7, 0x0b, 0x0b,
+    0x19, 0x19, 0x31, 0xc3, 0x85, 0x84, 0x0d, 0x4f, 0xdc, 0x3e, 0xd8, 0x73, 0x99, 0x33, 0x2a, 0x9a,
+    0x38, 0x6f, 0x43, 0x5a, 0x52, 0xa6, 0x0a, 0xad, 0x09, 0xd9, 0x4b, 0xd2, 0x3a, 0x01, 0x02, 0x91,
+    0x23, 0xd6, 0x88, 0xec, 0xec, 0x0b, 0xbf, 0x2c, 0x43, 0x37, 0x7d, 0xbd, 0x17, 0x2e, 0x27, 0x9d,
+    0x9b, 0x66, 0xd1, 0x41, 0x4e, 0x5d, 0x62, 0x0d, 0xa8, 0x7b, 0xe0, 0x37, 0x43, 0xb0, 0x1c, 0x73,
+    0xc1, 0x72, 0x7a, 0x76, 0x56, 0x0a, 0x3a, 0xcd, 0x4b, 0x72, 0x65, 0x67, 0x80, 0x40, 0x3b, 0xca,
+    0x5d, 0x99, 0x45, 0x18, 0x55, 0xb2, 0x28, 0x9c, 0x1a, 0x43, 0x04, 0x2a, 0x04, 0xf9, 0x50, 0x85,
+    0x0a, 0x5c, 0x84, 0x0c, 0x30, 0x52, 0x8b, 0x25, 0x35, 0x27, 0x48, 0xb6, 0x75, 0x63, 0xb6, 0x1f,
+    0x5d, 0xd5, 0x2c, 0xa4, 0x94, 0x15, 0x5e, 0x6d, 0x87, 0x07, 0x86, 0x5b, 0x83, 0x59, 0x2a, 0x2b,
+    0xa3, 0xd6, 0xe8, 0x4b, 0x7e, 0x35, 0x65, 0x1e, 0x18, 0xe3, 0xa4, 0x24, 0x18, 0x5c, 0xaa, 0x57,
+    0x8c, 0x6e, 0x27, 0x6e, 0x92, 0xd1, 0x6d, 0xb7, 0x6a, 0x89, 0x2c, 0x7a, 0x8f, 0x64, 0x74, 0xa9,
+    0x11, 0x0a, 0x3f, 0x76, 0x4f, 0x65, 0x60, 0x51, 0xdd, 0x57, 0x1e, 0x43, 0x58, 0x16, 0xd3, 0x80,
+    0x1f, 0x8d, 0x2e, 0xbe, 0x54, 0x6e, 0x8c, 0x20, 0xf3, 0x2f, 0xc5, 0xdb, 0x80, 0x83, 0x66, 0xd2,
+    0x44, 0xe7, 0x3f, 0x94, 0x72, 0x77, 0x2c, 0x59, 0x4f, 0x09, 0x10, 0x16, 0x5b, 0x62, 0xae, 0x1e,
+    0x99, 0xfe, 0x5f, 0x1a, 0x65, 0x02, 0x5b, 0xc1, 0xa9, 0x3c, 0xde, 0x24, 0xba, 0xc7, 0x6d, 0x3b,
+    0xe5, 0x99, 0xc5, 0xc9, 0x22, 0xf6, 0xf3, 0xea, 0xe3, 0xce, 0xcb, 0x33, 0x27, 0xbe, 0xa4, 0x92,
+    0xf6, 0xc8, 0x6f, 0x53, 0x3f, 0x23, 0x09, 0x7d, 0x4a, 0x60, 0x4b, 0x9f, 0x1a, 0xeb, 0xa9, 0x6c,
+    0xfc, 0xe7, 0x40, 0xd6, 0x85, 0xee, 0x46, 0xf8, 0x4c, 0x8f, 0x48, 0x71, 0x9c, 0x9d, 0x3c, 0x0e,
+    0x3b, 0xe4, 0x2a, 0xda, 0x0e, 0x9b, 0xb5, 0x79, 0x04, 0x13, 0xd7, 0x84, 0x95, 0xa9, 0x3c, 0x7d,
+    0x7c, 0x5c, 0x5d, 0x33, 0x5a, 0x8c, 0x6e, 0xbe, 0xfb, 0xc9, 0x67, 0xd2, 0x4e, 0x63, 0x72, 0x5a,
+    0x59, 0x48, 0xd2, 0xa3, 0x17, 0x79, 0x43, 0xa5, 0xfb, 0xba, 0x99, 0x1c, 0x11, 0x19, 0x1e, 0x38,
+    0x45, 0x47, 0xe2, 0x2b, 0x8d, 0x5c, 0x7b, 0x17, 0xca, 0x51, 0x0a, 0x66, 0x2c, 0xa4, 0xb3, 0x18,
+    0x3b, 0xdb, 0x1d, 0x08, 0xdf, 0xc6, 0x0c, 0xf8, 0x44, 0x42, 0x38, 0x1b, 0x61, 0x7e, 0x97, 0x64,
+    0x73, 0x05, 0x70, 0x31, 0x87, 0x99, 0xb9, 0xfd, 0x49, 0x23, 0x32, 0xd4, 0x8b, 0xe0, 0x5a, 0x5d,
+    0x8a, 0x73, 0xe1, 0xcb, 0xe3, 0xee, 0x7f, 0x0c, 0x3c, 0xf4, 0xdd, 0xbf, 0xfb, 0x0d, 0xb4, 0x35,
+    0xb5, 0x82, 0x88, 0x3b, 0xd6, 0x5e, 0x20, 0x5d, 0xaa, 0x2d, 0xdd, 0x47, 0x59, 0x2e, 0xb9, 0x9f,
+    0xd3, 0x8c, 0xb7, 0xac, 0xde, 0xd0, 0xcc, 0x94, 0x7d, 0xe1, 0x29, 0x59, 0x24, 0x58, 0xcb, 0x8e,
+    0x43, 0xad, 0x2d, 0x9c, 0xe7, 0x11, 0xef, 0xdf, 0x72, 0xfc, 0x8a, 0xb5, 0xf5, 0x8f, 0x10, 0x9b,
+    0xf5, 0x2c, 0x3a, 0x0b, 0x06, 0x1b, 0xb6, 0x0b, 0xdd, 0x9d, 0xc6, 0x2f, 0x08, 0x5d, 0x13, 0x17,
+    0x0e, 0x17, 0x23, 0x48, 0x68, 0x4d, 0x8e, 0x06, 0x66, 0x33, 0x52, 0x66, 0xec, 0x5e, 0x0e, 0x75,
+    0x15, 0x6b, 0x19, 0xe6, 0xf0, 0x24, 0x8c, 0x7c, 0xfd, 0x55, 0x6b, 0x8a, 0x1b, 0x0f, 0x4e, 0x34,
+    0x33, 0xa6, 0x0b, 0x79, 0xc3, 0x72, 0x30, 0x5e, 0x43, 0x14, 0x51, 0xc3, 0x66, 0xa1, 0x99, 0x8d,
+    0x9a, 0x2c, 0x7c, 0x92, 0x46, 0x65, 0xcb, 0x3a, 0x7d, 0xbc, 0x77, 0x69, 0x3a, 0x0e, 0x13, 0xd6,
+    0x96, 0x1f, 0x73, 0x63, 0x9e, 0x74, 0xc9, 0xeb, 0x16, 0x7b, 0x1e, 0xe7, 0xc6, 0xf6, 0xa2, 0xb2,
+    0x25, 0xa7, 0x9b, 0x8b, 0x8f, 0x8e, 0x91, 0x3d, 0xc1, 0x4c, 0xc9, 0xdb, 0x68, 0x4f, 0x3e, 0xc8,
+    0x4c, 0x33, 0xd9, 0xb8, 0xf4, 0x1e, 0xb4, 0xad, 0x51, 0x88, 0x1f, 0x19, 0x06, 0x29, 0xd5, 0x8e,
+    0x00, 0x00, 0x00, 0x00
+};
+
+/*
+==============
+crc16
+CRC-16/CCITT as id computes it: initial value 0xffff, no final xor
+==============
+*/
+static unsigned short crc16(byte *data, int length) {
+    unsigned short crc = 0xffff;
+    int i, bit;
+
+    for (i = 0; i < length; i++) {
+        crc ^= data[i] << 8;
+        for (bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+/*
+==============
+sequence_crc_byte
+Checksums the bytes of a move command that follow the checksum byte, salted
+by the sequence number of the datagram carrying them. Servers drop the
+rest of a datagram whose move checksum doesn't match.
+==============
+*/
+byte sequence_crc_byte(byte *data, int length, int sequence) {
+    byte block[60 + 4];
+    byte *salt = sequence_crc_table + sequence % (sizeof (sequence_crc_table) - 4);
+
+    // Only the first 60 bytes count
+    length = MIN(length, 60);
+    memcpy(block, data, length);
+    memcpy(block + length, salt, 4);
+
+    return crc16(block, length + 4) & 0xff;
+}
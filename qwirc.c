@@ -49,14 +49,17 @@ char *qwirc_start(Function* global_funcs) {
     // Add TCL bindings
     add_tcl_strings(qwirc_tcl_strings);
     add_tcl_ints(qwirc_tcl_ints);
+    add_tcl_commands(qwirc_tcl_cmds);
     if ((H_temp = find_bind_table("pub")))
         add_builtins(H_temp, qwirc_public_cmds);
+    if ((H_temp = find_bind_table("dcc")))
+        add_builtins(H_temp, qwirc_dcc_cmds);
 
     // Register chanflag +qwirc
     initudef(UDEF_FLAG, MODULE_NAME, 1);
 
     putlog(LOG_MISC, "*", "QuakeWorld IRC module (%s) v%d.%d loaded.", MODULE_NAME, VER1, VER2);
-    irc_msg_buf[0] = 0;
+    chat_clear();
 
     // Init mutex
     pthread_mutexattr_init(&qw_attr);
@@ -66,12 +69,35 @@ char *qwirc_start(Function* global_funcs) {
     // Init QuakeWorld character decoding table
     qw_cleantext_init();
 
+    // KTX end of match statistics are hidden unless the config says otherwise
+    filter_defaults();
+
     // Default colors for chat text
     color_chattext = 15;
     color_statusmessage = 9;
     color_normaltext = 16;
     color_centerprint = 6;
 
+    // Default chat pacing, a bit below what KTX flood protection allows
+    qw_chat_interval = 1500;
+    qw_chat_burst = 3;
+
+    // Obituaries are relayed as text even when a fragfile is loaded
+    qw_frag_relay = 1;
+
+    // Server text is relayed once in ten minutes, centerprints once in three
+    // seconds with two back-to-back
+    qw_dedupe_ttl = 600;
+    strcpy(qw_relay_limits, "centerprint 3000 2");
+
+    // A player may say four lines in eight seconds before being held back
+    qw_flood_lines = 4;
+    qw_flood_window = 8;
+
+    // Metrics are written only if qw_metrics_file is set
+    qw_metrics_interval = 15;
+    add_hook(HOOK_SECONDLY, (Function) qwirc_secondly);
+
     return NULL;
 }
 
@@ -82,49 +108,73 @@ Prints out module status information.
 ==============
  */
 static void qwirc_report(int idx, int details) {
-    if (details) {
+    int i;
+
+    if (!details) {
+        dprintf(idx, "    QuakeWorld module using %d bytes of memory, %ld bytes at most.\n",
+            qwirc_expmem(), mem_total.peak);
+    } else {
         dprintf(idx, "    by aku.hasanen@kapsi.fi.\n");
-        dprintf(idx, "    Using approximately %d bytes of memory.\n", qwirc_expmem());
+        dprintf(idx, "    Using %d bytes of memory, %ld bytes in session buffers.\n",
+            qwirc_expmem(), mem_session());
+        for (i = 0; i < mem_count; i++)
+            dprintf(idx, "      %-12s %8ld bytes now, %8ld at most, %ld allocations.\n",
+                mem_tag_names[i], mem_stats[i].live, mem_stats[i].peak, mem_stats[i].allocs);
+        dprintf(idx, "    Arena: %ld of %d bytes used at most.\n", __atomic_load_n(&arena_peak, __ATOMIC_RELAXED), ARENA_SIZE);
+        pthread_mutex_lock(&qw_mutex);
+        if (qw_running)
+            dprintf(idx, "    Traffic: %d B/s in, %d B/s out. Entities: %d B/s full, "
+                "%d B/s delta compressed.\n", net_stats.rate_in, net_stats.rate_out,
+                net_stats.rate_entity_full, net_stats.rate_entity_delta);
+        if (qw_running)
+            dprintf(idx, "    Rate: %d B/s of at most %d B/s.\n", qw.rate, qw_rate);
+        if (qw_running && net_stats.entity_slow_frames)
+            dprintf(idx, "    %d entity frames took longer than %d us to decode.\n",
+                net_stats.entity_slow_frames, ENTITY_BUDGET / 1000);
+        if (qw_running && frag_log_shared.count)
+            dprintf(idx, "    %d kills recognized this session.\n", frag_log_shared.count);
+        if (qw_running && net_stats.packets_per_hour)
+            dprintf(idx, "    Sending %d packets per connected hour.\n", net_stats.packets_per_hour);
+        if (latency_shared.relay.total)
+            dprintf(idx, "    QuakeWorld to IRC latency: %u us median, %u us 99th percentile, %u us max.\n",
+                histogram_percentile(&latency_shared.relay, 50), histogram_percentile(&latency_shared.relay, 99),
+                latency_shared.relay.max);
+        if (latency_shared.say.total)
+            dprintf(idx, "    !qsay to QuakeWorld latency: %u us median, %u us 99th percentile, %u us max.\n",
+                histogram_percentile(&latency_shared.say, 50), histogram_percentile(&latency_shared.say, 99),
+                latency_shared.say.max);
+        if (qw.reconnects)
+            dprintf(idx, "    Reconnected %d times, last took %d ms, average %d ms, "
+                "longest %d ms.\n", qw.reconnects, qw.reconnect_last,
+                (int) (qw.reconnect_total / qw.reconnects), qw.reconnect_max);
+        pthread_mutex_unlock(&qw_mutex);
     }
 }
 
 /*
 ==============
 qwirc_expmem
-Calculates module memory usage (bytes). Only an estimation.
+Returns the number of bytes the module has allocated with nmalloc.
 ==============
  */
 static int qwirc_expmem() {
-    int total_umem = 0, counter = 0;
-    cmd_t *cur_cmd;
-    tcl_strings *cur_str;
-    tcl_ints *cur_int;
-    
-    // These are prone to change, sizes are just calculated based on 
-    // declared variables in qwirc.h as of version 1.0
-    total_umem += (sizeof(int) * 11) + (sizeof(long) * 2); // Integers
-    total_umem += 25 + 25 + 100 + 100 + 100 + 256 + MAX_PRINT_MSG + 40; // Char tables
-    total_umem += sizeof(qw_mutex) + sizeof(qw_thread) + sizeof(qw_attr); // Threading
-    
-    // Count public commands
-    for (cur_cmd = qwirc_public_cmds; cur_cmd->name; cur_cmd++, counter++);
-    total_umem += sizeof(cmd_t) * counter;
-    // Count TCL strings
-    counter = 0;
-    for (cur_str = qwirc_tcl_strings; cur_str->name; cur_str++, counter++);
-    total_umem += sizeof(tcl_strings) * counter;
-    // Count TCL ints
-    counter = 0;
-    for (cur_int = qwirc_tcl_ints; cur_int->name; cur_int++, counter++);
-    total_umem += sizeof(tcl_ints) * counter;
-    
-    // Get QuakeWorld thread resource usage
-    if (qw_running) {
-        pthread_mutex_lock(&qw_mutex);
-        total_umem += qw_maxrss * 1024; // Convert to bytes
-        pthread_mutex_unlock(&qw_mutex);
-    }
-    return total_umem;
+    return mem_total.live;
+}
+
+/*
+==============
+qwirc_secondly
+Writes the metrics file every qw_metrics_interval seconds
+==============
+ */
+static void qwirc_secondly(void) {
+    static int elapsed;
+
+    if (!qw_metrics_file[0] || ++elapsed < MAX(qw_metrics_interval, 1))
+        return;
+    elapsed = 0;
+
+    metrics_write(qw_metrics_file);
 }
 
 /*
@@ -143,9 +193,14 @@ static int qwirc_shutdown(char* channel) {
         pthread_mutex_unlock(&qw_mutex);
     }
 
+    del_hook(HOOK_SECONDLY, (Function) qwirc_secondly);
+
     // Remove TCL bindings
     if ((H_temp = find_bind_table("pub")))
         rem_builtins(H_temp, qwirc_public_cmds);
+    if ((H_temp = find_bind_table("dcc")))
+        rem_builtins(H_temp, qwirc_dcc_cmds);
+    rem_tcl_commands(qwirc_tcl_cmds);
     rem_tcl_ints(qwirc_tcl_ints);
     rem_tcl_strings(qwirc_tcl_strings);
     module_undepend(MODULE_NAME);
@@ -244,18 +299,19 @@ static void qw_say(char *nick, char *host, char *hand, char *channel, char *text
             }
         }
 
-        char prefix[strlen(channel) + strlen(nick) + 13];
-        char irc_msg[MAX_STRING_CHARS];
+        if (strlen(text) >= MAX_CHAT_LEN) {
+            dprintf(DP_HELP, "PRIVMSG %s :%s: Can't handle a line that long!\n", channel, nick);
+            return;
+        }
 
-        // +7 comes from the added string "@IRC: " and "\n"
-        if ((strlen(text) + strlen(nick) + 7) < MAX_STRING_CHARS) {
-            // Add nick@IRC:
-            snprintf(irc_msg, strlen(nick) + strlen(text) + 7, "%s@IRC: %s\n", nick, text);
-            pthread_mutex_lock(&qw_mutex);
-            strncat(irc_msg_buf, irc_msg, strlen(irc_msg)); // Append to buffer
+        pthread_mutex_lock(&qw_mutex);
+        if (!chat_enqueue(nick, text)) {
             pthread_mutex_unlock(&qw_mutex);
-        } else
-            dprintf(DP_HELP, "PRIVMSG %s :%s: Can't handle a line that long!\n", prefix, text);
+            dprintf(DP_HELP, "PRIVMSG %s :%s: Too many messages queued for "
+                    "QuakeWorld, try again in a moment.\n", channel, nick);
+            return;
+        }
+        pthread_mutex_unlock(&qw_mutex);
     }
 }
 
@@ -302,6 +358,115 @@ static void qw_mapinfo(char *nick, char *host, char *hand, char *channel, char *
     pthread_mutex_unlock(&qw_mutex);
 }
 
+/*
+==============
+qw_players
+Lists the players on the server from the scoreboard
+==============
+ */
+static void qw_players(char *nick, char *host, char *hand, char *channel, char *text, int idx) {
+    char line[400];
+    bool connected;
+
+    if (!ngetudef(MODULE_NAME, channel))
+        return;
+    // Check if !qplayers is allowed by default. If not, check for uflag 'Q'
+    if (!(PERM_DEFAULT & PERM_QPLAYERS) && !has_qflag(hand, channel)) {
+        dprintf(DP_HELP, "PRIVMSG %s :You don't have permission to use !qplayers.", channel);
+        return;
+    }
+
+    pthread_mutex_lock(&qw_mutex);
+    if ((connected = qw_running))
+        scoreboard_players(&scoreboard_shared, line, sizeof (line));
+    pthread_mutex_unlock(&qw_mutex);
+
+    if (!connected)
+        dprintf(DP_HELP, "PRIVMSG %s :Not connected to QuakeWorld.", channel);
+    else
+        dprintf(DP_HELP, "PRIVMSG %s :%s", channel, line);
+}
+
+/*
+==============
+qw_score
+Shows the score from the scoreboard, by team in team games
+==============
+ */
+static void qw_score(char *nick, char *host, char *hand, char *channel, char *text, int idx) {
+    char line[400];
+    bool connected;
+
+    if (!ngetudef(MODULE_NAME, channel))
+        return;
+    // Check if !qscore is allowed by default. If not, check for uflag 'Q'
+    if (!(PERM_DEFAULT & PERM_QSCORE) && !has_qflag(hand, channel)) {
+        dprintf(DP_HELP, "PRIVMSG %s :You don't have permission to use !qscore.", channel);
+        return;
+    }
+
+    pthread_mutex_lock(&qw_mutex);
+    if ((connected = qw_running))
+        scoreboard_scores(&scoreboard_shared, line, sizeof (line));
+    pthread_mutex_unlock(&qw_mutex);
+
+    if (!connected)
+        dprintf(DP_HELP, "PRIVMSG %s :Not connected to QuakeWorld.", channel);
+    else
+        dprintf(DP_HELP, "PRIVMSG %s :%s", channel, line);
+}
+
+/*
+==============
+qw_last
+Replays the latest lines relayed this session to the user by NOTICE, so
+catching up doesn't fill the channel. "!qlast [count] [class]".
+==============
+ */
+static void qw_last(char *nick, char *host, char *hand, char *channel, char *text, int idx) {
+    static scrollentry_t lines[QLAST_MAX];
+    int index[QLAST_MAX];
+    char args[64], *arg, *save, stamp[16];
+    int i, count = QLAST_DEFAULT, found;
+    relayclass_t class = relay_count;   // Any class
+
+    if (!ngetudef(MODULE_NAME, channel))
+        return;
+    // Check if !qlast is allowed by default. If not, check for uflag 'Q'
+    if (!(PERM_DEFAULT & PERM_QLAST) && !has_qflag(hand, channel)) {
+        dprintf(DP_HELP, "PRIVMSG %s :You don't have permission to use !qlast.", channel);
+        return;
+    }
+
+    strncpy(args, text ? text : "", sizeof (args) - 1);
+    args[sizeof (args) - 1] = 0;
+    for (arg = strtok_r(args, " ", &save); arg; arg = strtok_r(NULL, " ", &save)) {
+        if (arg[0] >= '0' && arg[0] <= '9') {
+            count = MIN(MAX(atoi(arg), 1), QLAST_MAX);
+            continue;
+        }
+        for (class = 0; class < relay_count && strcasecmp(arg, relay_class_names[class]); class++);
+        if (class == relay_count) {
+            dprintf(DP_HELP, "NOTICE %s :Usage: !qlast [count] [status|normal|centerprint|chat]", nick);
+            return;
+        }
+    }
+
+    // Copy the lines out, so the lock isn't held while they are queued
+    pthread_mutex_lock(&qw_mutex);
+    found = scrollback_latest(&scrollback_shared, class, index, count);
+    for (i = 0; i < found; i++)
+        lines[i] = scrollback_shared.entry[index[i]];
+    pthread_mutex_unlock(&qw_mutex);
+
+    if (!found)
+        dprintf(DP_HELP, "NOTICE %s :Nothing relayed yet.", nick);
+    for (i = 0; i < found; i++) {
+        strftime(stamp, sizeof (stamp), "%H:%M:%S", localtime(&lines[i].time));
+        dprintf(DP_HELP, "NOTICE %s :[%s] %s", nick, stamp, lines[i].text);
+    }
+}
+
 /*
 ==============
 qw_help
@@ -340,121 +505,294 @@ static void qw_help(char *nick, char *host, char *hand, char *channel, char *tex
 
 /*
 ==============
-qw_to_irc_print
-Handles printing incoming text from QuakeWorld in IRC
+qw_dcc_replay
+Replays a packet capture and writes the resulting IRC output to a file
 ==============
  */
-void qw_to_irc_print(char* msg, int color) {
-    static bool ignore = false;
-    static char msg_buffer[MAX_PRINT_MSG];
-    
-    if (msg[0]) {
-        char* irc_msg = nmalloc(strlen(msg) + 1);
-        strncpy(irc_msg, msg, strlen(msg) + 1);
-        // Remove leading newlines
-        if (irc_msg[0] == '\n') {
-            memmove(msg, msg + 1, strlen(irc_msg) + 1);
-        }
+static int qw_dcc_replay(struct userrec *u, int idx, char *par) {
+    char *capture, *output;
+    FILE *out;
+    float elapsed;
+    int count;
+
+    capture = newsplit(&par);
+    output = newsplit(&par);
+    if (!capture[0] || !output[0]) {
+        dprintf(idx, "Usage: qwreplay <capture file> <output file>\n");
+        return 0;
+    }
+    if (qw_running) {
+        dprintf(idx, "Can't replay while connected to QuakeWorld.\n");
+        return 0;
+    }
+    if (!(out = fopen(output, "w"))) {
+        dprintf(idx, "Can't open %s: %s.\n", output, strerror(errno));
+        return 0;
+    }
 
-        // Get rid of QuakeWorld's character encoding
-        qw_cleantext(irc_msg);
+    count = capture_replay(capture, out, &elapsed);
+    fclose(out);
 
-        // Check for trigger messages.. We don't want to print all the
-        // player stats at the end of the map in ktx.. Ugly check but 
-        // there's no other way without modifying the QW server
-        if (!ignore && color == color_chattext) {
-            if (strnstr(irc_msg, 18, "Player statistics"))
-                ignore = true;
-        }
-        // Start printing again after this
-        else if (ignore && color == color_chattext) {
-            if (strnstr(irc_msg, strlen(msg), "top scorers"))
-                ignore = false;
+    if (count < 0)
+        dprintf(idx, "Replaying %s failed.\n", capture);
+    else
+        dprintf(idx, "Replayed %d packets in %.1f ms (%.0f packets/s). Output is in %s.\n",
+                count, elapsed, elapsed > 0 ? count * 1000 / elapsed : 0, output);
+    return 0;
+}
+
+/*
+==============
+qw_dcc_prof
+Shows where the QuakeWorld thread spends its time, for the last profiler
+window and since connecting
+==============
+ */
+static int qw_dcc_prof(struct userrec *u, int idx, char *par) {
+    static char *names[prof_count] = {"idle", "receive", "netchan", "parse", "entities",
+        "output", "transmit", "mutex", "rusage", "other"};
+    profwindow_t last, total;
+    float last_s, total_s;
+    int i;
+
+    pthread_mutex_lock(&qw_mutex);
+    last = profiler.last;
+    total = profiler.total;
+    pthread_mutex_unlock(&qw_mutex);
+
+    if (!total.elapsed) {
+        dprintf(idx, "No profile yet, one is made every %d seconds while connected.\n", PROF_WINDOW / 1000);
+        return 0;
+    }
+
+    last_s = last.elapsed / 1e9;
+    total_s = total.elapsed / 1e9;
+    dprintf(idx, "QuakeWorld thread, last %.0f s | all %.0f s:\n", last_s, total_s);
+    dprintf(idx, "  %-9s %9s %6s %8s %10s | %9s %6s %10s\n", "phase", "us/s", "share",
+            "calls/s", "longest", "us/s", "share", "longest");
+    for (i = 0; i < prof_count; i++)
+        dprintf(idx, "  %-9s %9.0f %5.1f%% %8.1f %8.0fus | %9.0f %5.1f%% %8.0fus\n", names[i],
+                last.time[i] / 1e3 / last_s, last.time[i] * 100.0 / last.elapsed, last.calls[i] / last_s,
+                last.max[i] / 1e3, total.time[i] / 1e3 / total_s, total.time[i] * 100.0 / total.elapsed,
+                total.max[i] / 1e3);
+    dprintf(idx, "  Frames: %u, longest %.0f us | %u, longest %.0f us.\n", last.frames,
+            last.frame_max / 1e3, total.frames, total.frame_max / 1e3);
+    return 0;
+}
+
+/*
+==============
+qw_dcc_flight
+Lists the latest datagrams from the flight recorder, oldest first, with
+their headers decoded and optionally hex dumps
+==============
+ */
+static int qw_dcc_flight(struct userrec *u, int idx, char *par) {
+    flight_rec_t rec;
+    uint64_t now;
+    char line[160], *arg;
+    int count = 16, back, offset;
+    bool hex = false;
+
+    while (*(arg = newsplit(&par))) {
+        if (!strcmp(arg, "hex"))
+            hex = true;
+        else if (atoi(arg) > 0)
+            count = MIN(atoi(arg), FLIGHT_RECORDS);
+        else {
+            dprintf(idx, "Usage: qwflight [count] [hex]\n");
+            return 0;
         }
+    }
 
-        if (!ignore) {
-            // Check if the string begins with the bot's nick. If so, remove.
-            char* bot_say_prefix = nmalloc(strlen(qw_name) + 3);
-            snprintf(bot_say_prefix, strlen(qw_name) + 3, "%s: ", qw_name);
-            if (strnstr(irc_msg, strlen(bot_say_prefix), bot_say_prefix) != NULL) {
-                memmove(irc_msg, irc_msg + strlen(bot_say_prefix), strlen(irc_msg) - strlen(bot_say_prefix));
-                // terminate
-                msg[strlen(irc_msg) - strlen(bot_say_prefix) + 1] = 0;
-            }
-            nfree(bot_say_prefix);
-            
-            // Append to buffer
-            strncat(msg_buffer, irc_msg, strlen(irc_msg));
-            // Print only if there's a new line
-            if (strnstr(msg_buffer, strlen(msg_buffer), "\n") != NULL) {
-                dprintf(DP_HELP, "PRIVMSG %s :\003%d%s", qw_channel, color, msg_buffer);
-                msg_buffer[0] = 0;
-            }
+    if (!flight_get(0, &rec)) {
+        dprintf(idx, "No datagrams recorded yet.\n");
+        return 0;
+    }
+    now = rec.time;
+
+    dprintf(idx, "Latest datagrams, times relative to the last one:\n");
+    for (back = count - 1; back >= 0; back--) {
+        if (!flight_get(back, &rec))
+            continue;
+        flight_describe(&rec, now, line, sizeof (line));
+        dprintf(idx, "%s\n", line);
+        if (hex) {
+            offset = 0;
+            do {
+                offset = flight_hexdump(&rec, offset, line, sizeof (line));
+                dprintf(idx, "%s\n", line);
+            } while (offset);
         }
-        nfree(irc_msg);
     }
+    return 0;
 }
 
 /*
-====================
-qw_cleantext_init
-Initializes QuakeWorld character encoding table.
-This code is from the mvdsv project.
-====================
+==============
+tcl_qwlatency
+TCL command "qwlatency <relay|say>". Returns the median, 99th percentile,
+maximum and sample count of a latency histogram, times in microseconds.
+==============
  */
-static void qw_cleantext_init(void) {
-    int i;
+static int tcl_qwlatency STDVAR {
+    static histogram_t h;
+    char result[64];
 
-    for (i = 0; i < 32; i++)
-        qw_char_tbl[i] = qw_char_tbl[i + 128] = '#';
-    for (i = 32; i < 128; i++)
-        qw_char_tbl[i] = qw_char_tbl[i + 128] = i;
+    BADARGS(2, 2, " relay|say");
 
-    // Special cases
-    qw_char_tbl[10] = 10;
-    qw_char_tbl[13] = 13;
+    if (strcmp(argv[1], "relay") && strcmp(argv[1], "say")) {
+        Tcl_AppendResult(irp, "unknown histogram \"", argv[1], "\", should be relay or say", NULL);
+        return TCL_ERROR;
+    }
 
-    // Dot
-    qw_char_tbl[5] = qw_char_tbl[14] = qw_char_tbl[15] = qw_char_tbl[28] = qw_char_tbl[46] = '.';
-    qw_char_tbl[5 + 128] = qw_char_tbl[14 + 128] = qw_char_tbl[15 + 128] = qw_char_tbl[28 + 128] = qw_char_tbl[46 + 128] = '.';
+    pthread_mutex_lock(&qw_mutex);
+    h = strcmp(argv[1], "relay") ? latency_shared.say : latency_shared.relay;
+    pthread_mutex_unlock(&qw_mutex);
 
-    // Numbers
-    for (i = 18; i < 28; i++)
-        qw_char_tbl[i] = qw_char_tbl[i + 128] = i + 30;
+    snprintf(result, sizeof (result), "%u %u %u %u", histogram_percentile(&h, 50),
+            histogram_percentile(&h, 99), h.max, h.total);
+    Tcl_AppendResult(irp, result, NULL);
+    return TCL_OK;
+}
 
-    // Brackets
-    qw_char_tbl[16] = qw_char_tbl[16 + 128] = '[';
-    qw_char_tbl[17] = qw_char_tbl[17 + 128] = ']';
+/*
+==============
+tcl_qwplayers
+TCL command "qwplayers". Returns the slots of the players and spectators
+on the server.
+==============
+ */
+static int tcl_qwplayers STDVAR {
+    char slot[8];
+    int i;
 
-    // Left arrow
-    qw_char_tbl[127] = '>';
-    // Right arrow
-    qw_char_tbl[141] = '<';
+    BADARGS(1, 1, "");
 
-    // '-'
-    qw_char_tbl[30] = qw_char_tbl[129] = qw_char_tbl[30 + 128] = '-';
-    qw_char_tbl[29] = qw_char_tbl[29 + 128] = qw_char_tbl[128] = '-';
-    qw_char_tbl[31] = qw_char_tbl[31 + 128] = qw_char_tbl[130] = '-';
+    pthread_mutex_lock(&qw_mutex);
+    for (i = 0; i < MAX_CLIENTS; i++)
+        if (scoreboard_shared.active[i]) {
+            snprintf(slot, sizeof (slot), "%d", i);
+            Tcl_AppendElement(irp, slot);
+        }
+    pthread_mutex_unlock(&qw_mutex);
+    return TCL_OK;
 }
 
 /*
 ==============
-qw_cleantext
-Gets rid of QuakeWorld's character encoding in order to display the text
-cleanly in IRC.
+tcl_qwplayer
+TCL command "qwplayer <slot>". Returns the name, team, frags, ping, packet
+loss and spectator flag of a player.
 ==============
  */
-static void qw_cleantext(char *text) {
-    for (; *text; text++) {
-        *text = qw_char_tbl[(unsigned char)*text];
-        // Remove double newlines
-        if (*text == '\n') {
-            if (text + 1) {
-                if (*(text + 1) == '\n')
-                    *text = ' ';
-            }
+static int tcl_qwplayer STDVAR {
+    char number[16];
+    int slot;
+
+    BADARGS(2, 2, " slot");
+
+    slot = atoi(argv[1]);
+    pthread_mutex_lock(&qw_mutex);
+    if (slot < 0 || slot >= MAX_CLIENTS || !scoreboard_shared.active[slot]) {
+        pthread_mutex_unlock(&qw_mutex);
+        Tcl_AppendResult(irp, "no player in slot ", argv[1], NULL);
+        return TCL_ERROR;
+    }
+    Tcl_AppendElement(irp, scoreboard_shared.clean_name[slot]);
+    Tcl_AppendElement(irp, scoreboard_shared.team[slot]);
+    snprintf(number, sizeof (number), "%d", scoreboard_shared.frags[slot]);
+    Tcl_AppendElement(irp, number);
+    snprintf(number, sizeof (number), "%d", scoreboard_shared.ping[slot]);
+    Tcl_AppendElement(irp, number);
+    snprintf(number, sizeof (number), "%d", scoreboard_shared.pl[slot]);
+    Tcl_AppendElement(irp, number);
+    Tcl_AppendElement(irp, scoreboard_shared.spectator[slot] ? "1" : "0");
+    pthread_mutex_unlock(&qw_mutex);
+    return TCL_OK;
+}
+
+/*
+==============
+tcl_qwfilter
+TCL command "qwfilter add <action> <classes> <pattern> ?class?", "qwfilter
+clear" and "qwfilter list". Changes take effect in the next QuakeWorld
+frame.
+==============
+ */
+static int tcl_qwfilter STDVAR {
+    char line[MAX_FILTER_PATTERN + 64], *error;
+    int i;
+
+    BADARGS(2, 6, " add|clear|list ?action classes pattern ?class??");
+
+    pthread_mutex_lock(&qw_mutex);
+    if (!strcmp(argv[1], "add") && argc >= 5) {
+        error = filter_add(argv[2], argv[3], argv[4], argc == 6 ? argv[5] : NULL);
+        pthread_mutex_unlock(&qw_mutex);
+        if (error) {
+            Tcl_AppendResult(irp, error, NULL);
+            return TCL_ERROR;
+        }
+        return TCL_OK;
+    } else if (!strcmp(argv[1], "clear") && argc == 2) {
+        filter_clear();
+    } else if (!strcmp(argv[1], "list") && argc == 2) {
+        for (i = 0; i < filter_rules.count; i++) {
+            filter_describe(i, line, sizeof (line));
+            Tcl_AppendElement(irp, line);
         }
+    } else {
+        pthread_mutex_unlock(&qw_mutex);
+        Tcl_AppendResult(irp, "wrong # args: should be \"", argv[0],
+                " add action classes pattern ?class?\", \"", argv[0], " clear\" or \"", argv[0], " list\"", NULL);
+        return TCL_ERROR;
     }
+    pthread_mutex_unlock(&qw_mutex);
+    return TCL_OK;
+}
+
+/*
+==============
+tcl_qwkills
+TCL command "qwkills ?count?". Returns the latest kill events, oldest
+first, each a list of kind, killer, victim and weapon.
+==============
+ */
+static int tcl_qwkills STDVAR {
+    killevent_t *event;
+    const char *fields[4];
+    char *list;
+    int count = FRAG_LOG_SIZE, i;
+
+    BADARGS(1, 2, " ?count?");
+
+    if (argc == 2)
+        count = MAX(atoi(argv[1]), 0);
+    pthread_mutex_lock(&qw_mutex);
+    count = MIN(count, MIN(frag_log_shared.count, FRAG_LOG_SIZE));
+    for (i = frag_log_shared.count - count; i < frag_log_shared.count; i++) {
+        event = &frag_log_shared.event[i % FRAG_LOG_SIZE];
+        fields[0] = kill_kind_names[event->kind];
+        fields[1] = event->killer;
+        fields[2] = event->victim;
+        fields[3] = event->weapon;
+        list = Tcl_Merge(4, fields);
+        Tcl_AppendElement(irp, list);
+        Tcl_Free(list);
+    }
+    pthread_mutex_unlock(&qw_mutex);
+    return TCL_OK;
+}
+
+/*
+==============
+qw_irc_output
+Sends a line of QuakeWorld text to the IRC channel
+==============
+ */
+void qw_irc_output(int color, char *text) {
+    dprintf(DP_HELP, "PRIVMSG %s :\003%d%s", qw_channel, color, text);
 }
 
 /*
@@ -35,19 +35,31 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define PERM_QRCON        0x00000008    // 8
 #define PERM_QMAP         0x00000010    // 16
 #define PERM_QHELP        0x00000020    // 32
-#define PERM_ALL          0x3F          // 63
-// !qsay, !qmap and !qhelp are allowed for all users by default
-#define PERM_DEFAULT      (PERM_QSAY | PERM_QMAP | PERM_QHELP)
+#define PERM_QPLAYERS     0x00000040    // 64
+#define PERM_QSCORE       0x00000080    // 128
+#define PERM_QLAST        0x00000100    // 256
+#define PERM_ALL          0x1FF         // 511
+// !qsay, !qmap, !qhelp, !qplayers, !qscore and !qlast are allowed for all users by default
+#define PERM_DEFAULT      (PERM_QSAY | PERM_QMAP | PERM_QHELP | PERM_QPLAYERS | PERM_QSCORE | PERM_QLAST)
+
+// Lines !qlast replays by default, and at most
+#define QLAST_DEFAULT     10
+#define QLAST_MAX         20
 
 // QuakeWorld server settings, text output colors. These are TCL-configurable
 char qw_name[25], qw_server[100], qw_password[100], qw_rcon_password[100];
+char qw_capture_file[MAX_OSPATH];
+char qw_metrics_file[MAX_OSPATH];
+char qw_print_filter[64];
+char qw_fragfile[MAX_OSPATH];
+char qw_relay_limits[64];
+int qw_frag_relay, qw_summary_window, qw_dedupe_ttl;
+int qw_flood_lines, qw_flood_window;
+int qw_metrics_interval;
 int qw_bottomcolor, qw_topcolor, qw_msgmode, qw_rate, qw_encrypt_rcon, qw_server_port;
+int qw_chat_interval, qw_chat_burst;
 int color_statusmessage, color_centerprint, color_normaltext, color_chattext;
 
-// Table for decoding QuakeWorld-encoded chat messages
-char qw_char_tbl[256]; 
-// Chat messages queued from IRC to QuakeWorld
-char irc_msg_buf[MAX_PRINT_MSG]; 
 // Amount of memory used by the QuakeWorld thread
 long qw_maxrss = 0;
 // Current QW map name
@@ -62,16 +74,25 @@ pthread_t qw_thread;
 int qw_thread_status = 1;
 
 // Module functions
-void irc_print(char* msg, int color);
 static int has_qflag(char* nick, char* channel);
-static void qw_cleantext(char* text);
-static void qw_cleantext_init (void);
 static void qw_rcon(char *nick, char *host, char *hand, char *channel, char *text, int idx);
 static void qw_mapinfo(char *nick, char *host, char *hand, char *channel, char *text, int idx);
 static void qw_help(char *nick, char *host, char *hand, char *channel, char *text, int idx);
+static void qw_players(char *nick, char *host, char *hand, char *channel, char *text, int idx);
+static void qw_score(char *nick, char *host, char *hand, char *channel, char *text, int idx);
+static void qw_last(char *nick, char *host, char *hand, char *channel, char *text, int idx);
 static void qw_connect(char *nick, char *host, char *hand, char *channel, char *text);
 static void qw_disconnect(char *nick, char *host, char *hand, char *channel, char *text);
 static void qw_say(char *nick, char *host, char *hand, char *channel, char *text, int idx);
+static int qw_dcc_replay(struct userrec *u, int idx, char *par);
+static int qw_dcc_prof(struct userrec *u, int idx, char *par);
+static int qw_dcc_flight(struct userrec *u, int idx, char *par);
+static int tcl_qwlatency STDVAR;
+static int tcl_qwplayers STDVAR;
+static int tcl_qwplayer STDVAR;
+static int tcl_qwfilter STDVAR;
+static int tcl_qwkills STDVAR;
+static void qwirc_secondly(void);
 
 static int qwirc_shutdown(char *channel);
 static void qwirc_report(int idx, int details);
@@ -100,9 +121,32 @@ static cmd_t qwirc_public_cmds[] =
     {"!qrcon",                "",               (IntFunc) qw_rcon,       NULL},
     {"!qmap",                 "",               (IntFunc) qw_mapinfo,    NULL},
     {"!qhelp",                "",               (IntFunc) qw_help,       NULL},
+    {"!qplayers",             "",               (IntFunc) qw_players,    NULL},
+    {"!qscore",               "",               (IntFunc) qw_score,      NULL},
+    {"!qlast",                "",               (IntFunc) qw_last,       NULL},
+    {NULL,                    NULL,             NULL,                    NULL}
+};
+
+// Partyline commands
+static cmd_t qwirc_dcc_cmds[] =
+{
+    {"qwreplay",              "n",              (IntFunc) qw_dcc_replay, NULL},
+    {"qwprof",                "m",              (IntFunc) qw_dcc_prof,   NULL},
+    {"qwflight",              "m",              (IntFunc) qw_dcc_flight, NULL},
     {NULL,                    NULL,             NULL,                    NULL}
 };
 
+// TCL commands
+static tcl_cmds qwirc_tcl_cmds[] =
+{
+    {"qwlatency",             tcl_qwlatency},
+    {"qwplayers",             tcl_qwplayers},
+    {"qwplayer",              tcl_qwplayer},
+    {"qwfilter",              tcl_qwfilter},
+    {"qwkills",               tcl_qwkills},
+    {NULL,                    NULL}
+};
+
 // TCL-configurable strings
 static tcl_strings qwirc_tcl_strings[] =
 {
@@ -110,6 +154,11 @@ static tcl_strings qwirc_tcl_strings[] =
     {"qw_name",               qw_name,          512,  0},
     {"qw_rcon_password",      qw_rcon_password, 512,  0},
     {"qw_password",           qw_password,      512,  0},
+    {"qw_capture_file",       qw_capture_file,  MAX_OSPATH - 1, 0},
+    {"qw_metrics_file",       qw_metrics_file,  MAX_OSPATH - 1, 0},
+    {"qw_print_filter",       qw_print_filter,  63,   0},
+    {"qw_fragfile",           qw_fragfile,      MAX_OSPATH - 1, 0},
+    {"qw_relay_limits",       qw_relay_limits,  63,   0},
     {0,                       0,                0,    0}
 };
 
@@ -126,6 +175,14 @@ static tcl_ints qwirc_tcl_ints[] =
   {"qw_topcolor",            &qw_topcolor,         0},
   {"qw_msgmode",             &qw_msgmode,          0},
   {"qw_rate",                &qw_rate,             0},
+  {"qw_chat_interval",       &qw_chat_interval,    0},
+  {"qw_chat_burst",          &qw_chat_burst,       0},
+  {"qw_metrics_interval",    &qw_metrics_interval, 0},
+  {"qw_frag_relay",          &qw_frag_relay,       0},
+  {"qw_summary_window",      &qw_summary_window,   0},
+  {"qw_dedupe_ttl",          &qw_dedupe_ttl,       0},
+  {"qw_flood_lines",         &qw_flood_lines,      0},
+  {"qw_flood_window",        &qw_flood_window,     0},
   {0,                        0,                    0}
 };      
 
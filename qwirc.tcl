@@ -10,7 +10,8 @@ set qw_rcon_password ""
 set qw_password ""
 # Encrypt rcon messages?
 set qw_encrypt_rcon 1
-# QuakeWorld transmission rate
+# QuakeWorld transmission rate. This is the most the bot asks for, it goes
+# lower on its own while the server has no need to hold anything back.
 set qw_rate 2500
 # QuakeWorld message mode
 set qw_msgmode 0
@@ -18,6 +19,45 @@ set qw_msgmode 0
 set qw_bottomcolor 0
 # QuakeWorld player topcolor
 set qw_topcolor 0
+# Milliseconds between !qsay messages sent in-game. Keeps the bot from being
+# muted by server flood protection.
+set qw_chat_interval 1500
+# How many !qsay messages can be sent back-to-back
+set qw_chat_burst 3
+# Server messages not to relay, by print level: any of low (item pickups),
+# medium (obituaries), high and chat. Takes effect on the next map.
+set qw_print_filter ""
+# Recognize death messages with this fragfile, in the ezQuake fragfile.dat
+# format (optional). The kill events are returned by qwkills.
+set qw_fragfile ""
+# Relay death messages recognized with the fragfile as text too?
+set qw_frag_relay 1
+# Sum up death messages and item pickups in one line every this many
+# seconds instead of relaying them one by one, 0 for off. Needs qw_fragfile
+# for death messages.
+set qw_summary_window 0
+# Seconds before the same server text or centerprint is relayed again, 0
+# for off
+set qw_dedupe_ttl 600
+# Rate limits for classes of lines as "class interval burst": one line every
+# interval ms, with burst lines back-to-back
+set qw_relay_limits "centerprint 3000 2"
+# Hold back chat from a player saying more than qw_flood_lines lines in
+# qw_flood_window seconds, 0 lines for off
+set qw_flood_lines 4
+set qw_flood_window 8
+# Record all datagrams received from the server to this file (optional).
+# Captures can be replayed with the partyline command .qwreplay
+set qw_capture_file ""
+# Write metrics in the Prometheus text format to this file (optional), e.g.
+# into the node exporter's textfile collector directory as qwirc.prom
+set qw_metrics_file ""
+# Seconds between metrics file updates
+set qw_metrics_interval 15
+# Message filter rules, see README. KTX end of match statistics are hidden
+# by default, e.g.:
+# qwfilter add suppress normal "entered the game"
+# qwfilter add route normal "\[info\]" status
 
 # IRC print colors
 set qw_color_chattext 15;